@@ -0,0 +1,715 @@
+/*                         ADLINK Edge SDK
+ *
+ *   This software and documentation are Copyright 2018 to 2020 ADLINK
+ *   Technology Limited, its affiliated companies and licensors. All rights
+ *   reserved.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/**
+ * This application measures how the round trip latency of the RoundTrip example degrades
+ * while the ThingThroughput example loads the DataRiver. It starts pong once, and for every
+ * background load level it starts a throughput reader and writer, lets the load settle, runs
+ * ping for a fixed time and stops the writer and reader again. The output is a table of the
+ * ping latency percentiles against the background throughput that the reader measured.
+ *
+ * The ping, pong, throughput writer and throughput reader are started in the directories
+ * in which they were built, so they find their configuration files.
+ *
+ */
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "include/cxxopts.hpp"
+
+using namespace std;
+
+#define NS_IN_ONE_US 1000.0
+#define PROCESS_STOP_TIMEOUT 10
+#define PING_EXTRA_TIME 60
+
+// The latency percentiles that ping writes in its summary record
+static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+static const size_t percentileCount = sizeof(percentiles) / sizeof(percentiles[0]);
+
+// Returns the name of a percentile as ping writes it, e.g. p99.9; the name is formatted on its
+// own stream so the number format of the output does not change it
+static string getPercentileName(size_t index) {
+    ostringstream name;
+    name << "p" << percentiles[index];
+
+    return name.str();
+}
+
+static atomic<bool> stop(false);
+
+static void ctrlHandler(int fdwCtrlType)
+{
+    stop = true;
+}
+
+// Output format of the results table
+enum OutputFormat {
+    text,
+    jsonl,
+    csv
+};
+
+// The settings of the benchmark
+typedef struct LoadedLatencySettings {
+    string roundTripDirectory;
+    string throughputDirectory;
+    string ping;
+    string pong;
+    string writer;
+    string reader;
+    vector<double> levels;
+    double maxRate;
+    unsigned long stepTime;
+    unsigned long settleTime;
+    unsigned long pingPayloadSize;
+    unsigned long backgroundPayloadSize;
+    vector<string> pingArgs;
+    vector<string> pongArgs;
+    vector<string> writerArgs;
+    vector<string> readerArgs;
+    string logDirectory;
+    OutputFormat outputFormat;
+} LoadedLatencySettings;
+
+// The result of one load level
+typedef struct LoadStep {
+    double level;
+    double offeredRate;
+    double samplesPerSecond;
+    double mbitPerSecond;
+    double lost;
+    double count;
+    double percentileValues[percentileCount];
+    double max;
+    bool valid;
+} LoadStep;
+
+// A process started by the benchmark, with its output in a log file
+typedef struct ChildProcess {
+    string name;
+#ifdef _WIN32
+    PROCESS_INFORMATION info;
+#else
+    pid_t pid;
+#endif
+    bool running;
+} ChildProcess;
+
+#ifdef _WIN32
+static string quoteArgument(const string& argument) {
+    if (!argument.empty() && argument.find_first_of(" \t\"") == string::npos) {
+        return argument;
+    }
+
+    string quoted = "\"";
+    for (char c : argument) {
+        if (c == '"') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+
+    return quoted + "\"";
+}
+
+// Starts an executable in a directory, in its own process group so it can be stopped with a ctrl-break
+static bool startProcess(ChildProcess& child, const string& directory, const string& executable,
+        const vector<string>& args, const string& logFile) {
+    child.name = executable;
+    child.running = false;
+
+    SECURITY_ATTRIBUTES security = { sizeof(security), NULL, TRUE };
+    HANDLE log = CreateFileA(logFile.c_str(), GENERIC_WRITE, FILE_SHARE_READ, &security, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (log == INVALID_HANDLE_VALUE) {
+        cerr << "ERROR: Cannot create " << logFile << endl;
+        return false;
+    }
+
+    STARTUPINFOA startup;
+    ZeroMemory(&startup, sizeof(startup));
+    startup.cb = sizeof(startup);
+    startup.dwFlags = STARTF_USESTDHANDLES;
+    startup.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    startup.hStdOutput = log;
+    startup.hStdError = log;
+
+    string commandLine = quoteArgument(directory + "\\" + executable);
+    for (const string& arg : args) {
+        commandLine += " " + quoteArgument(arg);
+    }
+
+    BOOL created = CreateProcessA(NULL, &commandLine[0], NULL, NULL, TRUE, CREATE_NEW_PROCESS_GROUP, NULL,
+            directory.c_str(), &startup, &child.info);
+    CloseHandle(log);
+    if (!created) {
+        cerr << "ERROR: Cannot start " << executable << " in " << directory << endl;
+        return false;
+    }
+    child.running = true;
+
+    return true;
+}
+
+// Waits until the process has exited, returns false on a timeout (0 is infinite) or when the benchmark is stopped
+static bool waitProcess(ChildProcess& child, unsigned long timeout, bool interruptible) {
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(timeout);
+    while (child.running) {
+        if (WaitForSingleObject(child.info.hProcess, 100) == WAIT_OBJECT_0) {
+            CloseHandle(child.info.hProcess);
+            CloseHandle(child.info.hThread);
+            child.running = false;
+        } else if ((timeout > 0 && chrono::steady_clock::now() > deadline) || (interruptible && stop)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void interruptProcess(ChildProcess& child) {
+    GenerateConsoleCtrlEvent(CTRL_BREAK_EVENT, child.info.dwProcessId);
+}
+
+static void killProcess(ChildProcess& child) {
+    TerminateProcess(child.info.hProcess, 1);
+}
+#else
+// Starts an executable in a directory, in its own process group so a ctrl-c of the benchmark does not reach it
+static bool startProcess(ChildProcess& child, const string& directory, const string& executable,
+        const vector<string>& args, const string& logFile) {
+    child.name = executable;
+    child.running = false;
+
+    int log = open(logFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (log < 0) {
+        cerr << "ERROR: Cannot create " << logFile << endl;
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        cerr << "ERROR: Cannot start " << executable << endl;
+        close(log);
+        return false;
+    }
+
+    if (pid == 0) {
+        setpgid(0, 0);
+        dup2(log, STDOUT_FILENO);
+        dup2(log, STDERR_FILENO);
+        close(log);
+        if (chdir(directory.c_str()) != 0) {
+            cerr << "ERROR: Cannot change to directory " << directory << endl;
+            _exit(127);
+        }
+
+        string path = (executable.find('/') == string::npos) ? "./" + executable : executable;
+        vector<char *> argv;
+        argv.push_back(const_cast<char *>(path.c_str()));
+        for (const string& arg : args) {
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        }
+        argv.push_back(NULL);
+        execv(path.c_str(), argv.data());
+
+        cerr << "ERROR: Cannot start " << path << " in " << directory << endl;
+        _exit(127);
+    }
+
+    close(log);
+    child.pid = pid;
+    child.running = true;
+
+    return true;
+}
+
+// Waits until the process has exited, returns false on a timeout (0 is infinite) or when the benchmark is stopped
+static bool waitProcess(ChildProcess& child, unsigned long timeout, bool interruptible) {
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(timeout);
+    while (child.running) {
+        int status;
+        if (waitpid(child.pid, &status, WNOHANG) == child.pid) {
+            child.running = false;
+        } else if ((timeout > 0 && chrono::steady_clock::now() > deadline) || (interruptible && stop)) {
+            return false;
+        } else {
+            this_thread::sleep_for(chrono::milliseconds(100));
+        }
+    }
+
+    return true;
+}
+
+static void interruptProcess(ChildProcess& child) {
+    kill(child.pid, SIGINT);
+}
+
+static void killProcess(ChildProcess& child) {
+    kill(child.pid, SIGKILL);
+}
+#endif
+
+// Stops a process the way a user would, with a ctrl-c, so it writes its summary.
+// A process that does not exit in time is killed.
+static void stopProcess(ChildProcess& child) {
+    if (!child.running) {
+        return;
+    }
+
+    interruptProcess(child);
+    if (!waitProcess(child, PROCESS_STOP_TIMEOUT, false)) {
+        cerr << "WARNING: " << child.name << " did not stop, killing it" << endl;
+        killProcess(child);
+        waitProcess(child, 0, false);
+    }
+}
+
+// Sleeps for a number of seconds, returns false when the benchmark is stopped
+static bool sleepSeconds(unsigned long seconds) {
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(seconds);
+    while (chrono::steady_clock::now() < deadline) {
+        if (stop) {
+            return false;
+        }
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+
+    return !stop;
+}
+
+// Gets the value of a number field from a JSON object on one line
+static bool getJsonNumber(const string& line, const string& name, double& value) {
+    size_t position = line.find("\"" + name + "\":");
+    if (position == string::npos) {
+        return false;
+    }
+
+    const char *start = line.c_str() + position + name.size() + 3;
+    char *end;
+    value = strtod(start, &end);
+
+    return end != start;
+}
+
+// Reads the jsonl records of a given type from a log file
+static vector<string> readRecords(const string& logFile, const string& type) {
+    vector<string> records;
+    ifstream in(logFile);
+    string line;
+    string typeField = "\"type\":\"" + type + "\"";
+    while (getline(in, line)) {
+        if (line.find(typeField) != string::npos) {
+            records.push_back(line);
+        }
+    }
+
+    return records;
+}
+
+// Gets the round trip latency from the summary that ping wrote
+static bool readLatency(const string& logFile, LoadStep& step) {
+    vector<string> summaries = readRecords(logFile, "summary");
+    if (summaries.empty()) {
+        return false;
+    }
+
+    const string& summary = summaries.back();
+    bool valid = getJsonNumber(summary, "count", step.count) && getJsonNumber(summary, "max", step.max);
+    for (size_t i = 0; i < percentileCount; i++) {
+        valid = getJsonNumber(summary, getPercentileName(i), step.percentileValues[i]) && valid;
+    }
+
+    return valid;
+}
+
+// Gets the background throughput from the records that the throughput reader wrote.
+// The throughput is the mean of the intervals after the settle time, without the last interval in
+// which the writer stopped; a run that is too short for that falls back on the summary.
+static bool readThroughput(const string& logFile, unsigned long settleTime, LoadStep& step) {
+    vector<string> intervals = readRecords(logFile, "interval");
+    vector<string> summaries = readRecords(logFile, "summary");
+    double samplesPerSecond = 0;
+    double mbitPerSecond = 0;
+    unsigned long count = 0;
+
+    for (size_t i = 0; i + 1 < intervals.size(); i++) {
+        double seconds, samples, mbit;
+        if (getJsonNumber(intervals[i], "seconds", seconds) && seconds > settleTime
+                && getJsonNumber(intervals[i], "samples_per_sec", samples) && getJsonNumber(intervals[i], "mbit_per_sec", mbit)) {
+            samplesPerSecond += samples;
+            mbitPerSecond += mbit;
+            count++;
+        }
+    }
+
+    step.lost = 0;
+    if (!summaries.empty()) {
+        getJsonNumber(summaries.back(), "lost", step.lost);
+    }
+
+    if (count > 0) {
+        step.samplesPerSecond = samplesPerSecond / count;
+        step.mbitPerSecond = mbitPerSecond / count;
+        return true;
+    }
+
+    return !summaries.empty()
+            && getJsonNumber(summaries.back(), "samples_per_sec", step.samplesPerSecond)
+            && getJsonNumber(summaries.back(), "mbit_per_sec", step.mbitPerSecond);
+}
+
+static string getLogFile(const LoadedLatencySettings& settings, const string& name, const string& step) {
+    return settings.logDirectory + "/" + name + (step.empty() ? "" : "-" + step) + ".log";
+}
+
+class LoadedLatency {
+public:
+    LoadedLatency(const LoadedLatencySettings& settings) : m_settings(settings) {
+        m_pong.running = false;
+        m_writer.running = false;
+        m_reader.running = false;
+    }
+
+    ~LoadedLatency() {
+        stopBackground();
+        stopProcess(m_pong);
+    }
+
+    int run();
+
+private:
+    bool startBackground(double rate, const string& step);
+    void stopBackground();
+    bool runStep(double level, LoadStep& result);
+    void showStep(const LoadStep& step);
+
+    LoadedLatencySettings m_settings;
+    ChildProcess m_pong;
+    ChildProcess m_writer;
+    ChildProcess m_reader;
+};
+
+// Starts the throughput reader and then the writer, which waits for the reader.
+// A rate of 0 writes as fast as possible.
+bool LoadedLatency::startBackground(double rate, const string& step) {
+    vector<string> readerArgs = { "--format", "jsonl" };
+    readerArgs.insert(readerArgs.end(), m_settings.readerArgs.begin(), m_settings.readerArgs.end());
+    if (!startProcess(m_reader, m_settings.throughputDirectory, m_settings.reader, readerArgs,
+            getLogFile(m_settings, "reader", step))) {
+        return false;
+    }
+
+    ostringstream rateValue;
+    rateValue << fixed << setprecision(0) << rate;
+    vector<string> writerArgs = { "-p", to_string(m_settings.backgroundPayloadSize), "--rate", rateValue.str() };
+    writerArgs.insert(writerArgs.end(), m_settings.writerArgs.begin(), m_settings.writerArgs.end());
+
+    return startProcess(m_writer, m_settings.throughputDirectory, m_settings.writer, writerArgs,
+            getLogFile(m_settings, "writer", step));
+}
+
+// Stops the writer before the reader, so the reader sees the complete stream
+void LoadedLatency::stopBackground() {
+    stopProcess(m_writer);
+    stopProcess(m_reader);
+}
+
+// Runs ping under one level of background load
+bool LoadedLatency::runStep(double level, LoadStep& result) {
+    ostringstream step;
+    step << level;
+
+    result.level = level;
+    result.offeredRate = m_settings.maxRate * level / 100;
+    result.samplesPerSecond = 0;
+    result.mbitPerSecond = 0;
+    result.lost = 0;
+    result.valid = false;
+
+    if (result.offeredRate > 0) {
+        if (!startBackground(result.offeredRate, step.str()) || !sleepSeconds(m_settings.settleTime)) {
+            stopBackground();
+            return false;
+        }
+    }
+
+    ChildProcess ping;
+    vector<string> pingArgs = { "--format", "jsonl", "-r", to_string(m_settings.stepTime),
+            "-p", to_string(m_settings.pingPayloadSize) };
+    pingArgs.insert(pingArgs.end(), m_settings.pingArgs.begin(), m_settings.pingArgs.end());
+    string pingLog = getLogFile(m_settings, "ping", step.str());
+    bool completed = startProcess(ping, m_settings.roundTripDirectory, m_settings.ping, pingArgs, pingLog)
+            && waitProcess(ping, m_settings.stepTime + PING_EXTRA_TIME, true);
+    if (!completed && ping.running) {
+        if (!stop) {
+            cerr << "WARNING: ping did not finish in time, see " << pingLog << endl;
+        }
+        stopProcess(ping);
+    }
+
+    stopBackground();
+
+    result.valid = completed && readLatency(pingLog, result);
+    if (completed && !result.valid) {
+        cerr << "WARNING: No latency summary in " << pingLog << endl;
+    }
+    if (result.offeredRate > 0 && !readThroughput(getLogFile(m_settings, "reader", step.str()), m_settings.settleTime, result)) {
+        cerr << "WARNING: No throughput records in " << getLogFile(m_settings, "reader", step.str()) << endl;
+    }
+
+    return completed;
+}
+
+void LoadedLatency::showStep(const LoadStep& step) {
+    cout << fixed;
+    if (m_settings.outputFormat == jsonl) {
+        cout << "{\"load_percentage\":" << setprecision(1) << step.level
+                << setprecision(0) << ",\"offered_rate\":" << step.offeredRate
+                << ",\"samples_per_sec\":" << step.samplesPerSecond
+                << setprecision(2) << ",\"mbit_per_sec\":" << step.mbitPerSecond
+                << setprecision(0) << ",\"lost\":" << step.lost
+                << ",\"count\":" << step.count;
+        cout << setprecision(1);
+        for (size_t i = 0; i < percentileCount; i++) {
+            cout << ",\"" << getPercentileName(i) << "_us\":" << step.percentileValues[i] / NS_IN_ONE_US;
+        }
+        cout << ",\"max_us\":" << step.max / NS_IN_ONE_US << "}" << endl;
+    } else if (m_settings.outputFormat == csv) {
+        cout << setprecision(1) << step.level << setprecision(0) << "," << step.offeredRate << "," << step.samplesPerSecond << ","
+                << setprecision(2) << step.mbitPerSecond << "," << setprecision(0) << step.lost << "," << step.count;
+        cout << setprecision(1);
+        for (size_t i = 0; i < percentileCount; i++) {
+            cout << "," << step.percentileValues[i] / NS_IN_ONE_US;
+        }
+        cout << "," << step.max / NS_IN_ONE_US << endl;
+    } else {
+        cout << setw(7) << right << setprecision(1) << step.level
+                << setw(14) << right << setprecision(0) << step.offeredRate
+                << setw(14) << right << step.samplesPerSecond
+                << setw(10) << right << setprecision(2) << step.mbitPerSecond
+                << setw(10) << right << setprecision(0) << step.count
+                << setprecision(1);
+        for (size_t i = 0; i < percentileCount; i++) {
+            cout << setw(11) << right << step.percentileValues[i] / NS_IN_ONE_US;
+        }
+        cout << setw(11) << right << step.max / NS_IN_ONE_US << endl;
+    }
+    cout.unsetf(ios_base::floatfield);
+}
+
+int LoadedLatency::run() {
+    if (!startProcess(m_pong, m_settings.roundTripDirectory, m_settings.pong, m_settings.pongArgs,
+            getLogFile(m_settings, "pong", ""))) {
+        return 1;
+    }
+
+    // Without a maximum rate, measure the throughput of an unthrottled writer first
+    if (m_settings.maxRate == 0) {
+        cerr << "Calibrating the maximum background throughput for " << m_settings.settleTime + m_settings.stepTime
+                << " seconds" << endl;
+        LoadStep calibration;
+        if (!startBackground(0, "calibration") || !sleepSeconds(m_settings.settleTime + m_settings.stepTime)) {
+            return 1;
+        }
+        stopBackground();
+        if (!readThroughput(getLogFile(m_settings, "reader", "calibration"), m_settings.settleTime, calibration)
+                || calibration.samplesPerSecond <= 0) {
+            cerr << "ERROR: No throughput measured, see " << getLogFile(m_settings, "reader", "calibration") << endl;
+            return 1;
+        }
+        m_settings.maxRate = calibration.samplesPerSecond;
+        cerr << "Maximum background throughput: " << fixed << setprecision(0) << m_settings.maxRate << " samples/s, "
+                << setprecision(2) << calibration.mbitPerSecond << " Mbit/s" << endl;
+        cerr.unsetf(ios_base::floatfield);
+    }
+
+    if (m_settings.outputFormat == csv) {
+        cout << "load_percentage,offered_rate,samples_per_sec,mbit_per_sec,lost,count";
+        for (size_t i = 0; i < percentileCount; i++) {
+            cout << "," << getPercentileName(i) << "_us";
+        }
+        cout << ",max_us" << endl;
+    } else if (m_settings.outputFormat == text) {
+        cout << endl << "Ping payload " << m_settings.pingPayloadSize << " bytes, background payload "
+                << m_settings.backgroundPayloadSize << " bytes, latency in us" << endl
+                << setw(7) << right << "load %"
+                << setw(14) << right << "offered/s"
+                << setw(14) << right << "samples/s"
+                << setw(10) << right << "Mbit/s"
+                << setw(10) << right << "pings";
+        for (size_t i = 0; i < percentileCount; i++) {
+            cout << setw(11) << right << getPercentileName(i);
+        }
+        cout << setw(11) << right << "max" << endl;
+    }
+
+    for (double level : m_settings.levels) {
+        LoadStep step;
+        if (!runStep(level, step)) {
+            break;
+        }
+        if (step.valid) {
+            showStep(step);
+        }
+    }
+
+    stopProcess(m_pong);
+
+    return stop ? 1 : 0;
+}
+
+static vector<string> splitArguments(const string& arguments) {
+    vector<string> result;
+    istringstream in(arguments);
+    string argument;
+    while (in >> argument) {
+        result.push_back(argument);
+    }
+
+    return result;
+}
+
+static bool parseLevels(const string& levels, vector<double>& result) {
+    istringstream in(levels);
+    string level;
+    while (getline(in, level, ',')) {
+        char *end;
+        double value = strtod(level.c_str(), &end);
+        if (end == level.c_str() || *end != '\0' || value < 0 || value > 100) {
+            return false;
+        }
+        result.push_back(value);
+    }
+
+    return !result.empty();
+}
+
+static void GetCommandLineParameters(int argc, char *argv[], LoadedLatencySettings& settings) {
+    cxxopts::Options options("LoadedLatency", "ADLINK ThingSDK LoadedLatency");
+    try {
+        options.add_options()
+            ("roundtrip-dir", "Directory in which ping and pong were built", cxxopts::value<string>()->default_value("."))
+            ("throughput-dir", "Directory in which the throughput writer and reader were built", cxxopts::value<string>()->default_value("."))
+            ("ping", "Ping executable", cxxopts::value<string>()->default_value("ping"))
+            ("pong", "Pong executable", cxxopts::value<string>()->default_value("pong"))
+            ("writer", "Throughput writer executable", cxxopts::value<string>()->default_value("throughputwriter"))
+            ("reader", "Throughput reader executable", cxxopts::value<string>()->default_value("throughputreader"))
+            ("levels", "Background load levels, in percent of the maximum rate", cxxopts::value<string>()->default_value("0,25,50,75,100"))
+            ("max-rate", "Maximum background rate in samples/s (0 measures the rate of an unthrottled writer first)", cxxopts::value<double>()->default_value("0"))
+            ("step-time", "Time in seconds that ping runs for each load level", cxxopts::value<unsigned long>()->default_value("10"))
+            ("settle-time", "Time in seconds that the background load runs before ping starts", cxxopts::value<unsigned long>()->default_value("2"))
+            ("ping-payload-size", "Ping payload size", cxxopts::value<unsigned long>()->default_value("0"))
+            ("background-payload-size", "Background payload size", cxxopts::value<unsigned long>()->default_value("4096"))
+            ("ping-args", "Additional ping arguments", cxxopts::value<string>()->default_value(""))
+            ("pong-args", "Additional pong arguments", cxxopts::value<string>()->default_value(""))
+            ("writer-args", "Additional throughput writer arguments", cxxopts::value<string>()->default_value(""))
+            ("reader-args", "Additional throughput reader arguments", cxxopts::value<string>()->default_value(""))
+            ("log-dir", "Directory for the output of the started processes", cxxopts::value<string>()->default_value("."))
+            ("format", "Output format of the results (text, jsonl, csv)", cxxopts::value<string>()->default_value("text"))
+            ("h,help", "Print help")
+            ;
+
+        auto cmdLineOptions = options.parse(argc, argv);
+
+        if (cmdLineOptions.count("help")) {
+            cout << options.help({""}) << endl;
+            exit(0);
+        }
+
+        settings.roundTripDirectory = cmdLineOptions["roundtrip-dir"].as<string>();
+        settings.throughputDirectory = cmdLineOptions["throughput-dir"].as<string>();
+        settings.ping = cmdLineOptions["ping"].as<string>();
+        settings.pong = cmdLineOptions["pong"].as<string>();
+        settings.writer = cmdLineOptions["writer"].as<string>();
+        settings.reader = cmdLineOptions["reader"].as<string>();
+        settings.maxRate = cmdLineOptions["max-rate"].as<double>();
+        settings.stepTime = cmdLineOptions["step-time"].as<unsigned long>();
+        settings.settleTime = cmdLineOptions["settle-time"].as<unsigned long>();
+        settings.pingPayloadSize = cmdLineOptions["ping-payload-size"].as<unsigned long>();
+        settings.backgroundPayloadSize = cmdLineOptions["background-payload-size"].as<unsigned long>();
+        settings.pingArgs = splitArguments(cmdLineOptions["ping-args"].as<string>());
+        settings.pongArgs = splitArguments(cmdLineOptions["pong-args"].as<string>());
+        settings.writerArgs = splitArguments(cmdLineOptions["writer-args"].as<string>());
+        settings.readerArgs = splitArguments(cmdLineOptions["reader-args"].as<string>());
+        settings.logDirectory = cmdLineOptions["log-dir"].as<string>();
+
+        string format = cmdLineOptions["format"].as<string>();
+        if (format == "text") {
+            settings.outputFormat = text;
+        } else if (format == "jsonl") {
+            settings.outputFormat = jsonl;
+        } else if (format == "csv") {
+            settings.outputFormat = csv;
+        } else {
+            throw cxxopts::OptionException("Invalid output format: " + format);
+        }
+
+        if (!parseLevels(cmdLineOptions["levels"].as<string>(), settings.levels)) {
+            throw cxxopts::OptionException("Invalid load levels, expected a list of percentages such as 0,25,50,75,100");
+        }
+
+        if (settings.maxRate < 0 || settings.stepTime == 0) {
+            cerr << "Invalid parameters" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+    }
+    catch (cxxopts::OptionException e) {
+        cerr << e.what() << endl << endl;
+        cout << options.help({""}) << endl;
+        exit(1);
+    }catch (const std::domain_error e1) {
+        cerr << e1.what() << endl << endl;
+        cout << options.help({""}) << endl;
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    // Get command line parameters
+    LoadedLatencySettings settings;
+    GetCommandLineParameters(argc, argv, settings);
+
+    // Stop the started processes on ctrl-c
+    signal(SIGINT, ctrlHandler);
+
+    LoadedLatency loadedLatency(settings);
+    return loadedLatency.run();
+}
@@ -19,15 +19,44 @@
 */
 
 #include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
 #include <signal.h>
+#include <sstream>
 #include <stdlib.h>
 #include <string>
+#include <thread>
 #include <time.h>
 #include <vector>
 #include <algorithm>
 #ifdef _WIN32
 #include <Windows.h>
+#include <TlHelp32.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define EXAMPLE_HAS_TSC
+#define EXAMPLE_HAS_PAUSE
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
 #endif
 
 using namespace std;
@@ -51,21 +80,474 @@ using namespace std;
 
 #endif // _WIN32
 
-using Clock = chrono::high_resolution_clock;
+using Clock = chrono::steady_clock;
 using Timepoint = chrono::time_point<Clock>;
 
+#define NS_IN_ONE_SEC 1000000000LL
+#define NS_IN_ONE_MS 1000000LL
 #define US_IN_ONE_SEC 1000000LL
 #define BYTES_PER_SEC_TO_MEGABITS_PER_SEC 125000
 
 typedef std::chrono::seconds Seconds;
 typedef std::chrono::milliseconds Milliseconds;
 typedef std::chrono::microseconds Microseconds;
+typedef std::chrono::nanoseconds Nanoseconds;
 template<typename ToType, typename FromType>
 unsigned long long Duration(const FromType& d)
 {
     return chrono::duration_cast<ToType>(d).count();
 }
 
+// Clock source used for latency measurements:
+//    steady = std::chrono::steady_clock
+//    tsc = invariant time-stamp counter of the CPU, calibrated against steady_clock at startup
+enum ClockSource {
+    steady,
+    tsc
+};
+
+static ClockSource exampleClockSource = ClockSource::steady;
+static unsigned long long exampleTscStartTicks = 0;
+static unsigned long long exampleTscStartNanoseconds = 0;
+static double exampleTscNanosecondsPerTick = 1.0;
+
+static unsigned long long exampleSteadyClockNanoseconds() {
+    return Duration<Nanoseconds>(Clock::now().time_since_epoch());
+}
+
+static bool exampleHasInvariantTsc() {
+#if defined(EXAMPLE_HAS_TSC) && defined(_WIN32)
+    int regs[4];
+    __cpuid(regs, 0x80000000);
+    if ((unsigned int)regs[0] < 0x80000007) {
+        return false;
+    }
+    __cpuid(regs, 0x80000007);
+    return (regs[3] & (1 << 8)) != 0;
+#elif defined(EXAMPLE_HAS_TSC)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0x80000000, 0) < 0x80000007) {
+        return false;
+    }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & (1 << 8)) != 0;
+#else
+    return false;
+#endif
+}
+
+static unsigned long long exampleReadTsc() {
+#ifdef EXAMPLE_HAS_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Selects the clock source used by exampleNowNanoseconds(). For the TSC clock source the tick
+// rate is measured against steady_clock over calibrationTime, and the TSC is anchored to the
+// steady_clock epoch so timestamps of processes on the same host stay comparable.
+// Returns false (and keeps using steady_clock) if the CPU has no invariant TSC.
+static bool exampleInitClock(ClockSource clockSource, Milliseconds calibrationTime = Milliseconds(200)) {
+    exampleClockSource = ClockSource::steady;
+    if (clockSource == ClockSource::steady) {
+        return true;
+    }
+
+    if (!exampleHasInvariantTsc()) {
+        return false;
+    }
+
+    unsigned long long startNanoseconds = exampleSteadyClockNanoseconds();
+    unsigned long long startTicks = exampleReadTsc();
+    this_thread::sleep_for(calibrationTime);
+    unsigned long long endNanoseconds = exampleSteadyClockNanoseconds();
+    unsigned long long endTicks = exampleReadTsc();
+
+    if (endTicks <= startTicks) {
+        return false;
+    }
+
+    exampleTscNanosecondsPerTick = (double)(endNanoseconds - startNanoseconds) / (endTicks - startTicks);
+    exampleTscStartTicks = endTicks;
+    exampleTscStartNanoseconds = endNanoseconds;
+    exampleClockSource = ClockSource::tsc;
+
+    return true;
+}
+
+// Returns the current time of the selected clock source in nanoseconds
+static inline unsigned long long exampleNowNanoseconds() {
+    if (exampleClockSource == ClockSource::tsc) {
+        return exampleTscStartNanoseconds
+            + (unsigned long long)((exampleReadTsc() - exampleTscStartTicks) * exampleTscNanosecondsPerTick);
+    }
+
+    return exampleSteadyClockNanoseconds();
+}
+
+// Returns the CPU time (user + system) consumed by all threads of this process, including
+// the threads of the Edge SDK, in nanoseconds
+static unsigned long long exampleProcessCpuNanoseconds() {
+#ifdef _WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+        return 0;
+    }
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernelTime.dwLowDateTime;
+    kernel.HighPart = kernelTime.dwHighDateTime;
+    user.LowPart = userTime.dwLowDateTime;
+    user.HighPart = userTime.dwHighDateTime;
+
+    return (kernel.QuadPart + user.QuadPart) * 100;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+
+    return (unsigned long long)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * NS_IN_ONE_SEC
+        + (unsigned long long)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000;
+#endif
+}
+
+// Returns the CPU time (user + system) consumed by the calling thread, in nanoseconds
+static unsigned long long exampleThreadCpuNanoseconds() {
+#ifdef _WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+        return 0;
+    }
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernelTime.dwLowDateTime;
+    kernel.HighPart = kernelTime.dwHighDateTime;
+    user.LowPart = userTime.dwLowDateTime;
+    user.HighPart = userTime.dwHighDateTime;
+
+    return (kernel.QuadPart + user.QuadPart) * 100;
+#elif defined(RUSAGE_THREAD)
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) != 0) {
+        return 0;
+    }
+
+    return (unsigned long long)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * NS_IN_ONE_SEC
+        + (unsigned long long)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000;
+#else
+    struct timespec time;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0) {
+        return 0;
+    }
+
+    return (unsigned long long)time.tv_sec * NS_IN_ONE_SEC + time.tv_nsec;
+#endif
+}
+
+// The CPU time that one thread of this process consumed
+typedef struct ExampleThreadCpu {
+    unsigned long long id;
+    string name;
+    unsigned long long cpuTime;
+} ExampleThreadCpu;
+
+// Returns the CPU time of the calling thread, for a thread that reports itself before it exits
+static ExampleThreadCpu exampleGetCurrentThreadCpu(const string& name) {
+    ExampleThreadCpu thread;
+#ifdef _WIN32
+    thread.id = GetCurrentThreadId();
+#elif defined(__linux__)
+    thread.id = (unsigned long long)syscall(SYS_gettid);
+#else
+    thread.id = 0;
+#endif
+    thread.name = name;
+    thread.cpuTime = exampleThreadCpuNanoseconds();
+
+    return thread;
+}
+
+// Returns the CPU time of every running thread of this process, including the threads of the
+// Edge SDK. On Linux the times come from procfs, in clock ticks.
+static vector<ExampleThreadCpu> exampleGetThreadCpuTimes() {
+    vector<ExampleThreadCpu> threads;
+#ifdef _WIN32
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (snapshot == INVALID_HANDLE_VALUE) {
+        return threads;
+    }
+    THREADENTRY32 entry;
+    entry.dwSize = sizeof(entry);
+    for (BOOL found = Thread32First(snapshot, &entry); found; found = Thread32Next(snapshot, &entry)) {
+        if (entry.th32OwnerProcessID != GetCurrentProcessId()) {
+            continue;
+        }
+        HANDLE handle = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, entry.th32ThreadID);
+        if (handle == NULL) {
+            continue;
+        }
+        FILETIME creationTime, exitTime, kernelTime, userTime;
+        if (GetThreadTimes(handle, &creationTime, &exitTime, &kernelTime, &userTime)) {
+            ULARGE_INTEGER kernel, user;
+            kernel.LowPart = kernelTime.dwLowDateTime;
+            kernel.HighPart = kernelTime.dwHighDateTime;
+            user.LowPart = userTime.dwLowDateTime;
+            user.HighPart = userTime.dwHighDateTime;
+            threads.push_back({ entry.th32ThreadID, "", (kernel.QuadPart + user.QuadPart) * 100 });
+        }
+        CloseHandle(handle);
+    }
+    CloseHandle(snapshot);
+#elif defined(__linux__)
+    DIR* tasks = opendir("/proc/self/task");
+    if (tasks == NULL) {
+        return threads;
+    }
+    long ticksPerSecond = sysconf(_SC_CLK_TCK);
+    struct dirent* task;
+    while ((task = readdir(tasks)) != NULL) {
+        if (task->d_name[0] == '.') {
+            continue;
+        }
+        ifstream in(string("/proc/self/task/") + task->d_name + "/stat");
+        string stat;
+        if (!getline(in, stat)) {
+            continue;
+        }
+
+        // The thread name is in parentheses and may contain spaces; utime and stime are the
+        // 12th and 13th field after it
+        size_t nameStart = stat.find('(');
+        size_t nameEnd = stat.rfind(')');
+        if (nameStart == string::npos || nameEnd == string::npos || nameEnd + 2 > stat.size()) {
+            continue;
+        }
+        istringstream fields(stat.substr(nameEnd + 2));
+        string field;
+        for (int i = 0; i < 11; i++) {
+            fields >> field;
+        }
+        unsigned long long userTicks, systemTicks;
+        if (fields >> userTicks >> systemTicks) {
+            threads.push_back({ strtoull(task->d_name, NULL, 10), stat.substr(nameStart + 1, nameEnd - nameStart - 1),
+                (userTicks + systemTicks) * NS_IN_ONE_SEC / ticksPerSecond });
+        }
+    }
+    closedir(tasks);
+#endif
+
+    return threads;
+}
+
+// Shows the CPU time that each thread consumed between two snapshots, and the work done per
+// CPU-second of the whole process. Threads that exited before the end snapshot are only in the
+// process CPU time, unless they reported themselves with exampleGetCurrentThreadCpu.
+static void exampleShowThreadCpuTimes(ostream& out, const vector<ExampleThreadCpu>& start, vector<ExampleThreadCpu> end,
+        unsigned long long elapsedTime, unsigned long long processCpuTime, unsigned long long work, const string& unit) {
+    for (ExampleThreadCpu& thread : end) {
+        for (const ExampleThreadCpu& startThread : start) {
+            if (startThread.id == thread.id) {
+                thread.cpuTime -= min(thread.cpuTime, startThread.cpuTime);
+                break;
+            }
+        }
+    }
+    sort(end.begin(), end.end(), [](const ExampleThreadCpu& a, const ExampleThreadCpu& b) {
+        return a.cpuTime > b.cpuTime;
+    });
+
+    double seconds = (double)elapsedTime / NS_IN_ONE_SEC;
+    out << fixed << "CPU time per thread over " << setprecision(1) << seconds << " s:" << endl;
+    for (const ExampleThreadCpu& thread : end) {
+        out << "  " << setw(8) << right << thread.id << "  " << setw(16) << left << thread.name
+            << setw(10) << right << setprecision(1) << (double)thread.cpuTime / NS_IN_ONE_MS << " ms"
+            << setw(8) << right << (seconds > 0 ? (double)thread.cpuTime / NS_IN_ONE_SEC * 100 / seconds : 0.0) << "%" << endl;
+    }
+    out << "Process CPU time: " << setprecision(1) << (double)processCpuTime / NS_IN_ONE_MS << " ms, "
+        << (seconds > 0 ? (double)processCpuTime / NS_IN_ONE_SEC * 100 / seconds : 0.0) << "% of one core";
+    if (!unit.empty() && processCpuTime > 0) {
+        out << ", " << setprecision(0) << (double)work * NS_IN_ONE_SEC / processCpuTime << " " << unit << " per CPU-second";
+    }
+    out << endl;
+    out.unsetf(ios_base::floatfield);
+}
+
+// Names the calling thread, so it can be told apart in the CPU time per thread (Linux)
+static void exampleSetThreadName(const string& name) {
+#ifdef __linux__
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+#endif
+}
+
+// CPU placement and scheduling of the process, set before any thread is started
+typedef struct ExampleSchedulingSettings {
+    vector<unsigned int> cpus;
+    vector<unsigned int> numaNodes;
+    int fifoPriority;
+    bool lockMemory;
+    bool threadCpu;
+} ExampleSchedulingSettings;
+
+#define EXAMPLE_CPU_LIST_MAX 65536
+#define EXAMPLE_NUMA_MAX_NODES 1024
+#define EXAMPLE_MPOL_BIND 2
+
+// Parses a list of CPUs or NUMA nodes such as "0-3,8"; an empty list is valid
+static bool exampleParseCpuList(const string& list, vector<unsigned int>& result) {
+    istringstream in(list);
+    string range;
+    while (getline(in, range, ',')) {
+        unsigned long first, last;
+        char separator;
+        istringstream values(range);
+        if (!(values >> first)) {
+            return false;
+        }
+        if (values >> separator) {
+            if (separator != '-' || !(values >> last) || last < first) {
+                return false;
+            }
+        } else {
+            last = first;
+        }
+        if (last >= EXAMPLE_CPU_LIST_MAX) {
+            return false;
+        }
+        if (!values.eof() && values.peek() != EOF) {
+            return false;
+        }
+        for (unsigned long value = first; value <= last; value++) {
+            result.push_back((unsigned int)value);
+        }
+    }
+
+    return true;
+}
+
+// Applies the scheduling settings to the calling thread. Threads started afterwards, including
+// the threads of the Edge SDK, inherit the CPU set, the memory policy and the scheduling policy,
+// so this is called from main before the Thing is created.
+static bool exampleApplySchedulingSettings(const ExampleSchedulingSettings& settings) {
+#ifdef __linux__
+    if (!settings.cpus.empty()) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (unsigned int cpu : settings.cpus) {
+            if (cpu >= CPU_SETSIZE) {
+                cerr << "ERROR: CPU " << cpu << " is out of range" << endl;
+                return false;
+            }
+            CPU_SET(cpu, &cpus);
+        }
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+            cerr << "ERROR: Cannot set the CPU affinity: " << strerror(errno) << endl;
+            return false;
+        }
+    }
+
+    if (!settings.numaNodes.empty()) {
+        // set_mempolicy is called directly, so the examples do not depend on libnuma
+        const size_t wordBits = 8 * sizeof(unsigned long);
+        unsigned long nodes[EXAMPLE_NUMA_MAX_NODES / wordBits] = { 0 };
+        for (unsigned int node : settings.numaNodes) {
+            if (node >= EXAMPLE_NUMA_MAX_NODES) {
+                cerr << "ERROR: NUMA node " << node << " is out of range" << endl;
+                return false;
+            }
+            nodes[node / wordBits] |= 1UL << (node % wordBits);
+        }
+        if (syscall(SYS_set_mempolicy, EXAMPLE_MPOL_BIND, nodes, EXAMPLE_NUMA_MAX_NODES + 1) != 0) {
+            cerr << "ERROR: Cannot bind the memory to the NUMA nodes: " << strerror(errno) << endl;
+            return false;
+        }
+    }
+
+    if (settings.fifoPriority > 0) {
+        struct sched_param param;
+        param.sched_priority = settings.fifoPriority;
+        if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) {
+            cerr << "ERROR: Cannot set SCHED_FIFO priority " << settings.fifoPriority << " (" << sched_get_priority_min(SCHED_FIFO)
+                << ".." << sched_get_priority_max(SCHED_FIFO) << "): " << strerror(errno) << endl;
+            return false;
+        }
+    }
+
+    if (settings.lockMemory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        cerr << "ERROR: Cannot lock the memory: " << strerror(errno) << endl;
+        return false;
+    }
+#else
+#ifdef _WIN32
+    if (!settings.cpus.empty()) {
+        DWORD_PTR mask = 0;
+        for (unsigned int cpu : settings.cpus) {
+            if (cpu >= 8 * sizeof(DWORD_PTR)) {
+                cerr << "ERROR: CPU " << cpu << " is out of range" << endl;
+                return false;
+            }
+            mask |= (DWORD_PTR)1 << cpu;
+        }
+        if (!SetProcessAffinityMask(GetCurrentProcess(), mask)) {
+            cerr << "ERROR: Cannot set the CPU affinity" << endl;
+            return false;
+        }
+    }
+#else
+    if (!settings.cpus.empty()) {
+        cerr << "ERROR: The CPU affinity is not supported on this platform" << endl;
+        return false;
+    }
+#endif
+    if (!settings.numaNodes.empty() || settings.fifoPriority > 0 || settings.lockMemory) {
+        cerr << "ERROR: NUMA binding, SCHED_FIFO and memory locking are only supported on Linux" << endl;
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+// Receive strategy used to wait for samples:
+//    blocking = read with a timeout, the reading thread sleeps until data arrives
+//    spin = busy-poll with zero-timeout reads, see exampleSpinBackoff()
+//    listener = a DataAvailableListener, called by a Dispatcher on the reading thread
+enum ReceiveStrategy {
+    blocking,
+    spin,
+    listener
+};
+
+static const char* exampleReceiveStrategyName(ReceiveStrategy receiveStrategy) {
+    switch (receiveStrategy) {
+    case ReceiveStrategy::spin:
+        return "spin";
+    case ReceiveStrategy::listener:
+        return "listener";
+    default:
+        return "blocking";
+    }
+}
+
+// Called by a spinning reader after a poll that returned no data. Without a maximum backoff
+// only a CPU pause hint is issued and the reader keeps polling at full speed. With a maximum
+// backoff the reader sleeps between polls, doubling the sleep time up to maxBackoff
+// microseconds, trading wake-up latency for CPU time. Set backoff to 0 after a poll that
+// returned data.
+static inline void exampleSpinBackoff(unsigned long& backoff, unsigned long maxBackoff) {
+    if (maxBackoff == 0 || backoff == 0) {
+#ifdef EXAMPLE_HAS_PAUSE
+        _mm_pause();
+#else
+        this_thread::yield();
+#endif
+        backoff = (maxBackoff > 0) ? 1 : 0;
+        return;
+    }
+
+    this_thread::sleep_for(Microseconds(backoff));
+    backoff = min(backoff * 2, maxBackoff);
+}
+
 static atomic<bool> stop(false);
 
 #ifndef _WIN32
@@ -100,15 +582,156 @@ static void unregisterControlHandler() {
 }
 
 
+// Header that ping stores at the start of the payload. Pong sends it back unmodified, unless
+// magic is EXAMPLE_PAYLOAD_INSTRUMENTED: then pong fills in the time it read the ping and the
+// time it wrote the pong, using the same clock as ping when both run on the same host.
+// With EXAMPLE_PAYLOAD_INSTRUMENTED or EXAMPLE_PAYLOAD_IDENTIFIED pong also fills in its
+// pongId (see exampleHashThingId), so ping can tell the pongs of a fan-out apart.
+// Ping and pong are expected to run on hosts with the same byte order.
+#define EXAMPLE_PAYLOAD_INSTRUMENTED 0x54534554534E49ULL
+#define EXAMPLE_PAYLOAD_IDENTIFIED 0x44454946495445ULL
+
+typedef struct ExamplePayloadHeader {
+    unsigned long long magic;
+    unsigned long long requestId;
+    unsigned long long pingWriteTime;
+    unsigned long long pongReadTime;
+    unsigned long long pongWriteTime;
+    unsigned long long pongId;
+} ExamplePayloadHeader;
+
+#define EXAMPLE_PAYLOAD_HEADER_SIZE sizeof(ExamplePayloadHeader)
+
+void exampleWritePayloadHeader(unsigned char* payload, const ExamplePayloadHeader& header) {
+    memcpy(payload, &header, EXAMPLE_PAYLOAD_HEADER_SIZE);
+}
+
+bool exampleReadPayloadHeader(const unsigned char* payload, size_t payloadSize, ExamplePayloadHeader& header) {
+    if (payloadSize < EXAMPLE_PAYLOAD_HEADER_SIZE) {
+        return false;
+    }
+    memcpy(&header, payload, EXAMPLE_PAYLOAD_HEADER_SIZE);
+
+    return true;
+}
+
+// FNV-1a hash of a Thing id, the same in every ping and pong process
+static unsigned long long exampleHashThingId(const string& thingId) {
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : thingId) {
+        hash = (hash ^ c) * 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+// Output of the measurements: text for humans, or one JSON object or CSV row per record
+enum OutputFormat {
+    text,
+    jsonl,
+    csv
+};
+
+static string exampleHostName() {
+    char name[256] = "";
+#ifdef _WIN32
+    DWORD size = sizeof(name);
+    if (!GetComputerNameA(name, &size)) {
+        return "unknown";
+    }
+#else
+    if (gethostname(name, sizeof(name) - 1) != 0) {
+        return "unknown";
+    }
+#endif
+
+    return name;
+}
+
+// Compiler, build type and build time of the example, to tell the records of different builds apart
+static string exampleBuildInfo() {
+    ostringstream info;
+#if defined(__clang__)
+    info << "clang " << __clang_major__ << "." << __clang_minor__ << "." << __clang_patchlevel__;
+#elif defined(__GNUC__)
+    info << "gcc " << __GNUC__ << "." << __GNUC_MINOR__ << "." << __GNUC_PATCHLEVEL__;
+#elif defined(_MSC_VER)
+    info << "msvc " << _MSC_VER;
+#endif
+#ifdef NDEBUG
+    info << " release";
+#else
+    info << " debug";
+#endif
+    info << " " << __DATE__ << " " << __TIME__;
+
+    return info.str();
+}
+
+static string exampleJsonString(const string& value) {
+    string json = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            json += '\\';
+        }
+        json += c;
+    }
+
+    return json + "\"";
+}
+
+// ExampleTimeStats is a log-linear (HDR-style) histogram with a fixed memory footprint:
+// values below 2 * EXAMPLE_STATS_SUB_BUCKETS are counted exactly, larger values are counted in
+// EXAMPLE_STATS_SUB_BUCKETS linear sub-buckets per power of two. This bounds the relative error
+// of a reported percentile to 1 / EXAMPLE_STATS_SUB_BUCKETS (< 1%) over the full 64-bit range,
+// while recording a value is O(1) and two histograms can be merged by adding their counters.
+#define EXAMPLE_STATS_SUB_BUCKET_BITS 7
+#define EXAMPLE_STATS_SUB_BUCKETS (1ULL << EXAMPLE_STATS_SUB_BUCKET_BITS)
+#define EXAMPLE_STATS_BUCKET_COUNT ((64 - EXAMPLE_STATS_SUB_BUCKET_BITS + 1) * EXAMPLE_STATS_SUB_BUCKETS)
+
 typedef struct ExampleTimeStats {
-    vector<unsigned long> values;
+    vector<unsigned long long> counts;
+    unsigned long long count;
     double average;
-    unsigned long min;
-    unsigned long max;
+    unsigned long long min;
+    unsigned long long max;
 } ExampleTimeStats;
 
+static unsigned int exampleMostSignificantBit(unsigned long long value) {
+    unsigned int bit = 0;
+    if (value >> 32) { value >>= 32; bit += 32; }
+    if (value >> 16) { value >>= 16; bit += 16; }
+    if (value >> 8) { value >>= 8; bit += 8; }
+    if (value >> 4) { value >>= 4; bit += 4; }
+    if (value >> 2) { value >>= 2; bit += 2; }
+    if (value >> 1) { bit += 1; }
+
+    return bit;
+}
+
+static size_t exampleGetTimeStatsIndex(unsigned long long value) {
+    unsigned int msb = exampleMostSignificantBit(value);
+    unsigned int bucket = (msb > EXAMPLE_STATS_SUB_BUCKET_BITS) ? msb - EXAMPLE_STATS_SUB_BUCKET_BITS : 0;
+
+    return ((size_t)bucket << EXAMPLE_STATS_SUB_BUCKET_BITS) + (size_t)(value >> bucket);
+}
+
+// Returns the highest value that is counted in the histogram entry at the given index
+static unsigned long long exampleGetTimeStatsValue(size_t index) {
+    if (index < 2 * EXAMPLE_STATS_SUB_BUCKETS) {
+        return index;
+    }
+
+    unsigned int bucket = (unsigned int)(index >> EXAMPLE_STATS_SUB_BUCKET_BITS) - 1;
+    unsigned long long subBucket = index - ((size_t)bucket << EXAMPLE_STATS_SUB_BUCKET_BITS);
+
+    return ((subBucket + 1) << bucket) - 1;
+}
+
 ExampleTimeStats exampleInitTimeStats() {
     ExampleTimeStats stats;
+    stats.counts.assign(EXAMPLE_STATS_BUCKET_COUNT, 0);
+    stats.count = 0;
     stats.average = 0;
     stats.min = 0;
     stats.max = 0;
@@ -116,40 +739,84 @@ ExampleTimeStats exampleInitTimeStats() {
     return stats;
 }
 
-ExampleTimeStats* exampleAddMicrosecondsToTimeStats(ExampleTimeStats* stats, unsigned long microseconds) {
-    stats->average = (stats->values.size() * stats->average + microseconds) / (stats->values.size() + 1);
-    stats->values.push_back(microseconds);
-    stats->min = (stats->min == 0 || microseconds < stats->min) ? microseconds : stats->min;
-    stats->max = (microseconds > stats->max) ? microseconds : stats->max;
+ExampleTimeStats* exampleAddNanosecondsToTimeStats(ExampleTimeStats* stats, unsigned long long nanoseconds) {
+    stats->counts[exampleGetTimeStatsIndex(nanoseconds)]++;
+    stats->average = (stats->count * stats->average + nanoseconds) / (stats->count + 1);
+    stats->min = (stats->count == 0 || nanoseconds < stats->min) ? nanoseconds : stats->min;
+    stats->max = (nanoseconds > stats->max) ? nanoseconds : stats->max;
+    stats->count++;
 
     return stats;
 }
 
-double exampleGetMedianFromTimeStats(ExampleTimeStats* stats) {
-    sort(stats->values.begin(), stats->values.end());
+// Adds all values recorded in 'from' to 'stats'
+ExampleTimeStats* exampleMergeTimeStats(ExampleTimeStats* stats, const ExampleTimeStats* from) {
+    if (from->count == 0) {
+        return stats;
+    }
+
+    for (size_t i = 0; i < EXAMPLE_STATS_BUCKET_COUNT; i++) {
+        stats->counts[i] += from->counts[i];
+    }
+    stats->average = (stats->count * stats->average + from->count * from->average) / (stats->count + from->count);
+    stats->min = (stats->count == 0 || from->min < stats->min) ? from->min : stats->min;
+    stats->max = (from->max > stats->max) ? from->max : stats->max;
+    stats->count += from->count;
+
+    return stats;
+}
+
+// Returns the value below which the given percentage (0..100) of the recorded values fall
+unsigned long long exampleGetPercentileFromTimeStats(const ExampleTimeStats* stats, double percentile) {
+    if (stats->count == 0) {
+        return 0;
+    }
 
-    if (stats->values.size() % 2 == 0) {
-        return (double)(stats->values[stats->values.size() / 2 - 1] + stats->values[stats->values.size() / 2]) / 2;
+    unsigned long long target = (unsigned long long)((percentile / 100.0) * stats->count + 0.5);
+    if (target < 1) {
+        target = 1;
     }
 
-    return (double)stats->values[stats->values.size() / 2];
+    unsigned long long total = 0;
+    for (size_t i = 0; i < EXAMPLE_STATS_BUCKET_COUNT; i++) {
+        total += stats->counts[i];
+        if (total >= target) {
+            unsigned long long value = exampleGetTimeStatsValue(i);
+            return (value > stats->max) ? stats->max : value;
+        }
+    }
+
+    return stats->max;
+}
+
+double exampleGetMedianFromTimeStats(ExampleTimeStats* stats) {
+    return (double)exampleGetPercentileFromTimeStats(stats, 50.0);
 }
 
 void exampleResetTimeStats(ExampleTimeStats& stats) {
-    stats.values.clear();
+    fill(stats.counts.begin(), stats.counts.end(), 0);
+    stats.count = 0;
     stats.average = 0;
     stats.min = 0;
     stats.max = 0;
 }
 
-ExampleTimeStats& operator+=(ExampleTimeStats& stats, unsigned long microseconds) {
-    return *exampleAddMicrosecondsToTimeStats(&stats, microseconds);
+ExampleTimeStats& operator+=(ExampleTimeStats& stats, unsigned long long nanoseconds) {
+    return *exampleAddNanosecondsToTimeStats(&stats, nanoseconds);
+}
+
+ExampleTimeStats& operator+=(ExampleTimeStats& stats, const ExampleTimeStats& from) {
+    return *exampleMergeTimeStats(&stats, &from);
 }
 
 double exampleGetMedianFromTimeStats(ExampleTimeStats& stats) {
     return exampleGetMedianFromTimeStats(&stats);
 }
 
+unsigned long long exampleGetPercentileFromTimeStats(const ExampleTimeStats& stats, double percentile) {
+    return exampleGetPercentileFromTimeStats(&stats, percentile);
+}
+
 #ifdef _WIN32
 
 static DWORD dwOriginalOutMode = 0;
@@ -23,16 +23,22 @@
  */
 #include <chrono>
 #include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <stdlib.h>
 #include <thread>
 #include <time.h>
+#include <unordered_map>
 #ifdef _WIN32
 #include <Windows.h>
 #endif
 
+#include <Dispatcher.hpp>
 #include <JSonThingAPI.hpp>
 #include <ThingAPIException.hpp>
 
@@ -46,11 +52,203 @@ using namespace std;
 using namespace com::adlinktech::datariver;
 using namespace com::adlinktech::iot;
 
-static ExampleTimeStats roundTripOverall = exampleInitTimeStats();
-static ExampleTimeStats writeAccessOverall = exampleInitTimeStats();
-static ExampleTimeStats readAccessOverall = exampleInitTimeStats();
+// Warm-up ends when the round trip medians of this many consecutive windows are within the
+// warm-up tolerance, windows with fewer samples are extended
+#define WARMUP_STABLE_WINDOWS 5
+#define WARMUP_MIN_WINDOW_SAMPLES 10
+
+// Latency stats of one measurement interval. The one-way stats are only
+// recorded when ping runs with an instrumented payload, the write delay
+// and uncorrected round trip only when ping writes at a fixed rate, the
+// first and all replies only when ping fans out to several pongs.
+typedef struct PingStats {
+	ExampleTimeStats roundTrip;
+	ExampleTimeStats writeAccess;
+	ExampleTimeStats readAccess;
+	ExampleTimeStats pingToPong;
+	ExampleTimeStats pongService;
+	ExampleTimeStats pongToPing;
+	ExampleTimeStats writeDelay;
+	ExampleTimeStats uncorrectedRoundTrip;
+	ExampleTimeStats firstReply;
+	ExampleTimeStats allReplies;
+	unsigned long long measurementTime;
+	unsigned long long cpuTime;
+} PingStats;
+
+static PingStats initPingStats() {
+	PingStats stats;
+	stats.roundTrip = exampleInitTimeStats();
+	stats.writeAccess = exampleInitTimeStats();
+	stats.readAccess = exampleInitTimeStats();
+	stats.pingToPong = exampleInitTimeStats();
+	stats.pongService = exampleInitTimeStats();
+	stats.pongToPing = exampleInitTimeStats();
+	stats.writeDelay = exampleInitTimeStats();
+	stats.uncorrectedRoundTrip = exampleInitTimeStats();
+	stats.firstReply = exampleInitTimeStats();
+	stats.allReplies = exampleInitTimeStats();
+	stats.measurementTime = 0;
+	stats.cpuTime = 0;
+
+	return stats;
+}
+
+static void resetPingStats(PingStats& stats) {
+	exampleResetTimeStats(stats.roundTrip);
+	exampleResetTimeStats(stats.writeAccess);
+	exampleResetTimeStats(stats.readAccess);
+	exampleResetTimeStats(stats.pingToPong);
+	exampleResetTimeStats(stats.pongService);
+	exampleResetTimeStats(stats.pongToPing);
+	exampleResetTimeStats(stats.writeDelay);
+	exampleResetTimeStats(stats.uncorrectedRoundTrip);
+	exampleResetTimeStats(stats.firstReply);
+	exampleResetTimeStats(stats.allReplies);
+	stats.measurementTime = 0;
+	stats.cpuTime = 0;
+}
+
+static PingStats& operator+=(PingStats& stats, const PingStats& from) {
+	stats.roundTrip += from.roundTrip;
+	stats.writeAccess += from.writeAccess;
+	stats.readAccess += from.readAccess;
+	stats.pingToPong += from.pingToPong;
+	stats.pongService += from.pongService;
+	stats.pongToPing += from.pongToPing;
+	stats.writeDelay += from.writeDelay;
+	stats.uncorrectedRoundTrip += from.uncorrectedRoundTrip;
+	stats.firstReply += from.firstReply;
+	stats.allReplies += from.allReplies;
+	stats.measurementTime += from.measurementTime;
+	stats.cpuTime += from.cpuTime;
+
+	return stats;
+}
+
+static PingStats overallStats = initPingStats();
+static bool instrumented = false;
+static bool openLoop = false;
+static unsigned long pongCount = 1;
+static ReceiveStrategy receiveStrategy = ReceiveStrategy::blocking;
+static unsigned long spinBackoff = 0;
+static string flowId;
+static unsigned long warmUpWindow = 100;
+static double warmUpTolerance = 5.0;
+static unsigned long warmUpMaxTime = 30;
+static OutputFormat outputFormat = text;
+static string pingMode;
+static string hostName;
+static string buildInfo;
+static ExampleSchedulingSettings scheduling;
+static unsigned long currentPayloadSize = 0;
+
+// QoS profile of the Ping and Pong TagGroups, recorded with the machine-readable output
+#define PING_QOS_PROFILE "event"
+
+static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+static const size_t percentileCount = sizeof(percentiles) / sizeof(percentiles[0]);
+
+static void showPercentiles(ostream& out, const char* name, const ExampleTimeStats& stats) {
+	out << COLOR_GREEN << "# " << setw(14) << left << name
+		<< setw(10) << right << stats.count
+		<< setw(11) << right << stats.min;
+	for (double percentile : percentiles) {
+		out << setw(11) << right << exampleGetPercentileFromTimeStats(stats, percentile);
+	}
+	out << setw(11) << right << stats.max << NO_COLOR << endl;
+}
+
+// Progress and status messages; with jsonl and csv, stdout only carries the records
+static ostream& messageStream() {
+	return (outputFormat == text) ? cout : cerr;
+}
+
+static string formatMedian(ExampleTimeStats& stats) {
+	ostringstream median;
+	median << fixed << setprecision(0) << exampleGetMedianFromTimeStats(stats);
+
+	return median.str();
+}
+
+// Writes the stats of one interval, or the overall stats, as a JSON object or a CSV row.
+// Times are in ns; columns that do not apply to the ping mode are left out (jsonl) or empty (csv).
+static void writeRecord(bool overall, unsigned long elapsedSeconds, PingStats& stats) {
+	vector<pair<string, string> > fields;
+	ostringstream value;
+	auto add = [&fields, &value](const string& name, bool valid) {
+		fields.push_back(make_pair(name, valid ? value.str() : string()));
+		value.str("");
+	};
+
+	value << fixed << setprecision(3);
+	value << exampleJsonString(overall ? "summary" : "interval"); add("type", true);
+	value << (overall ? (double)stats.measurementTime / NS_IN_ONE_SEC : (double)elapsedSeconds); add("seconds", true);
+	value << exampleJsonString(hostName); add("host", true);
+	value << currentPayloadSize; add("payload_size", true);
+	value << exampleJsonString(pingMode); add("mode", true);
+	value << exampleJsonString(exampleReceiveStrategyName(receiveStrategy)); add("receive", true);
+	value << exampleJsonString(PING_QOS_PROFILE); add("qos_profile", true);
+	value << exampleJsonString(buildInfo); add("build", true);
+	value << stats.roundTrip.count; add("count", true);
+	value << (stats.roundTrip.count ? stats.roundTrip.min : 0); add("min", true);
+	for (double percentile : percentiles) {
+		ostringstream name;
+		name << "p" << percentile;
+		value << exampleGetPercentileFromTimeStats(stats.roundTrip, percentile); add(name.str(), true);
+	}
+	value << stats.roundTrip.max; add("max", true);
+	value << setprecision(1) << stats.roundTrip.average; add("mean", true);
+	value << formatMedian(stats.writeAccess); add("write_access_median", true);
+	value << formatMedian(stats.readAccess); add("read_access_median", true);
+	value << (stats.measurementTime ? (double)(pongCount > 1 ? stats.firstReply.count : stats.roundTrip.count) * NS_IN_ONE_SEC / stats.measurementTime : 0.0);
+	add("requests_per_sec", true);
+	value << (stats.measurementTime ? (double)stats.cpuTime * 100 / stats.measurementTime : 0.0); add("cpu_percentage", true);
+	value << formatMedian(stats.pingToPong); add("ping_to_pong_median", instrumented);
+	value << formatMedian(stats.pongService); add("pong_service_median", instrumented);
+	value << formatMedian(stats.pongToPing); add("pong_to_ping_median", instrumented);
+	value << formatMedian(stats.uncorrectedRoundTrip); add("uncorrected_median", openLoop);
+	value << exampleGetPercentileFromTimeStats(stats.uncorrectedRoundTrip, 99.0); add("uncorrected_p99", openLoop);
+	value << stats.writeDelay.max; add("write_delay_max", openLoop);
+	value << formatMedian(stats.firstReply); add("first_reply_median", pongCount > 1);
+	value << formatMedian(stats.allReplies); add("all_replies_median", pongCount > 1);
+	value << exampleGetPercentileFromTimeStats(stats.allReplies, 99.0); add("all_replies_p99", pongCount > 1);
+
+	static bool csvHeaderShown = false;
+	if (outputFormat == csv && !csvHeaderShown) {
+		for (size_t i = 0; i < fields.size(); i++) {
+			cout << (i ? "," : "") << fields[i].first;
+		}
+		cout << endl;
+		csvHeaderShown = true;
+	}
+
+	bool first = true;
+	for (const auto& field : fields) {
+		if (outputFormat == jsonl) {
+			if (!field.second.empty()) {
+				cout << (first ? "{" : ",") << "\"" << field.first << "\":" << field.second;
+				first = false;
+			}
+		} else {
+			// CSV cells are not quoted, only the JSON strings are
+			string cell = field.second;
+			if (cell.size() >= 2 && cell.front() == '"') {
+				cell = cell.substr(1, cell.size() - 2);
+			}
+			cout << (first ? "" : ",") << cell;
+			first = false;
+		}
+	}
+	cout << (outputFormat == jsonl ? "}" : "") << endl;
+}
+
+static void showStats(bool overall, unsigned long elapsedSeconds, PingStats& stats) {
+	if (outputFormat != text) {
+		writeRecord(overall, elapsedSeconds, stats);
+		return;
+	}
 
-static void showStats(bool overall, unsigned long elapsedSeconds, ExampleTimeStats roundTrip, ExampleTimeStats writeAccess, ExampleTimeStats readAccess) {
 	if (overall) {
 		cout << endl << COLOR_GREEN << "# Overall";
 	} else {
@@ -58,21 +256,71 @@ static void showStats(bool overall, unsigned long elapsedSeconds, ExampleTimeSta
 	}
 
 	cout
-		<< setw(10) << right << roundTrip.values.size()
-		<< setw(9) << right << fixed << setprecision(0) << exampleGetMedianFromTimeStats(roundTrip)
-		<< setw(9) << right << roundTrip.min
-		<< setw(11) << right << writeAccess.values.size()
-		<< setw(9) << right << fixed << setprecision(0) << exampleGetMedianFromTimeStats(writeAccess)
-		<< setw(9) << right << writeAccess.min
-		<< setw(11) << right << readAccess.values.size()
-		<< setw(9) << right << fixed << setprecision(0) << exampleGetMedianFromTimeStats(readAccess)
-		<< setw(9) << right << readAccess.min << NO_COLOR << endl;
+		<< setw(10) << right << stats.roundTrip.count
+		<< setw(11) << right << fixed << setprecision(0) << exampleGetMedianFromTimeStats(stats.roundTrip)
+		<< setw(11) << right << stats.roundTrip.min
+		<< setw(11) << right << exampleGetPercentileFromTimeStats(stats.roundTrip, 99.0)
+		<< setw(11) << right << stats.roundTrip.max
+		<< setw(11) << right << stats.writeAccess.count
+		<< setw(11) << right << fixed << setprecision(0) << exampleGetMedianFromTimeStats(stats.writeAccess)
+		<< setw(11) << right << stats.writeAccess.min
+		<< setw(11) << right << stats.readAccess.count
+		<< setw(11) << right << fixed << setprecision(0) << exampleGetMedianFromTimeStats(stats.readAccess)
+		<< setw(11) << right << stats.readAccess.min
+		<< setw(12) << right << fixed << setprecision(0)
+			<< (stats.measurementTime ? (double)(pongCount > 1 ? stats.firstReply.count : stats.roundTrip.count) * NS_IN_ONE_SEC / stats.measurementTime : 0.0);
+	if (instrumented) {
+		cout
+			<< setw(11) << right << fixed << setprecision(0) << exampleGetMedianFromTimeStats(stats.pingToPong)
+			<< setw(11) << right << fixed << setprecision(0) << exampleGetMedianFromTimeStats(stats.pongService)
+			<< setw(11) << right << fixed << setprecision(0) << exampleGetMedianFromTimeStats(stats.pongToPing);
+	}
+	if (openLoop) {
+		cout
+			<< setw(11) << right << fixed << setprecision(0) << exampleGetMedianFromTimeStats(stats.uncorrectedRoundTrip)
+			<< setw(11) << right << exampleGetPercentileFromTimeStats(stats.uncorrectedRoundTrip, 99.0)
+			<< setw(11) << right << stats.writeDelay.max;
+	}
+	if (pongCount > 1) {
+		cout
+			<< setw(11) << right << fixed << setprecision(0) << exampleGetMedianFromTimeStats(stats.firstReply)
+			<< setw(11) << right << fixed << setprecision(0) << exampleGetMedianFromTimeStats(stats.allReplies)
+			<< setw(11) << right << exampleGetPercentileFromTimeStats(stats.allReplies, 99.0);
+	}
+	cout << setw(8) << right << fixed << setprecision(1)
+		<< (stats.measurementTime ? (double)stats.cpuTime * 100 / stats.measurementTime : 0.0);
+	cout << NO_COLOR << endl;
+
+	if (overall) {
+		cout << COLOR_GREEN << "#                    Count        min        p50        p90        p99      p99.9     p99.99        max" << NO_COLOR << endl;
+		showPercentiles(cout, "Round trip", stats.roundTrip);
+		showPercentiles(cout, "Write access", stats.writeAccess);
+		showPercentiles(cout, "Read access", stats.readAccess);
+		if (instrumented) {
+			showPercentiles(cout, "Ping to pong", stats.pingToPong);
+			showPercentiles(cout, "Pong service", stats.pongService);
+			showPercentiles(cout, "Pong to ping", stats.pongToPing);
+		}
+		if (openLoop) {
+			showPercentiles(cout, "Uncorrected", stats.uncorrectedRoundTrip);
+			showPercentiles(cout, "Write delay", stats.writeDelay);
+		}
+		if (pongCount > 1) {
+			showPercentiles(cout, "First reply", stats.firstReply);
+			showPercentiles(cout, "All replies", stats.allReplies);
+		}
+		cout << COLOR_GREEN << "# CPU time with " << exampleReceiveStrategyName(receiveStrategy) << " receive: "
+			<< fixed << setprecision(0) << stats.cpuTime / 1000000.0 << " ms, "
+			<< setprecision(1) << (stats.measurementTime ? (double)stats.cpuTime * 100 / stats.measurementTime : 0.0) << "% of one core, "
+			<< setprecision(0) << (stats.roundTrip.count ? (double)stats.cpuTime / stats.roundTrip.count : 0.0) << " ns per round trip"
+			<< NO_COLOR << endl;
+	}
 }
 
 #ifdef _WIN32
 static bool ctrlHandler(DWORD fdwCtrlType)
 {
-    showStats(true, 0, roundTripOverall, writeAccessOverall, readAccessOverall);
+    showStats(true, 0, overallStats);
     resetConsoleMode();
 	ExitProcess(1); // perform a brute-force exit for now
     return true;
@@ -80,19 +328,121 @@ static bool ctrlHandler(DWORD fdwCtrlType)
 #else
 static void ctrlHandler(int fdwCtrlType)
 {
-    showStats(true, 0, roundTripOverall, writeAccessOverall, readAccessOverall);
+    showStats(true, 0, overallStats);
     exit(1);
 }
 #endif
 
-class Ping {
+// Round trip summary of one payload size of a sweep
+typedef struct SweepResult {
+	unsigned long payloadSize;
+	unsigned long long count;
+	unsigned long long min;
+	unsigned long long percentileValues[percentileCount];
+	unsigned long long max;
+	double average;
+	double requestsPerSecond;
+	double cpuPercentage;
+} SweepResult;
+
+static SweepResult getSweepResult(unsigned long payloadSize, const PingStats& stats) {
+	SweepResult result;
+	result.payloadSize = payloadSize;
+	result.count = stats.roundTrip.count;
+	result.min = stats.roundTrip.count ? stats.roundTrip.min : 0;
+	for (size_t i = 0; i < percentileCount; i++) {
+		result.percentileValues[i] = exampleGetPercentileFromTimeStats(stats.roundTrip, percentiles[i]);
+	}
+	result.max = stats.roundTrip.max;
+	result.average = stats.roundTrip.average;
+	result.requestsPerSecond = stats.measurementTime ? (double)stats.roundTrip.count * NS_IN_ONE_SEC / stats.measurementTime : 0.0;
+	result.cpuPercentage = stats.measurementTime ? (double)stats.cpuTime * 100 / stats.measurementTime : 0.0;
+
+	return result;
+}
+
+// Writes the round trip time (in ns) as a function of the payload size, as CSV or JSON
+static void writeSweepCurve(ostream& out, bool json, const vector<SweepResult>& results) {
+	if (json) {
+		out << "[" << endl;
+	} else {
+		out << "payload_size,count,min";
+		for (size_t i = 0; i < percentileCount; i++) {
+			out << ",p" << percentiles[i];
+		}
+		out << ",max,mean,requests_per_sec,cpu_percentage" << endl;
+	}
+
+	for (size_t r = 0; r < results.size(); r++) {
+		const SweepResult& result = results[r];
+		if (json) {
+			out << "  { \"payload_size\": " << result.payloadSize << ", \"count\": " << result.count << ", \"min\": " << result.min;
+			for (size_t i = 0; i < percentileCount; i++) {
+				out << ", \"p" << percentiles[i] << "\": " << result.percentileValues[i];
+			}
+			out << ", \"max\": " << result.max << fixed << setprecision(1) << ", \"mean\": " << result.average
+				<< ", \"requests_per_sec\": " << result.requestsPerSecond << ", \"cpu_percentage\": " << result.cpuPercentage
+				<< " }" << (r + 1 < results.size() ? "," : "") << endl;
+		} else {
+			out << result.payloadSize << "," << result.count << "," << result.min;
+			for (size_t i = 0; i < percentileCount; i++) {
+				out << "," << result.percentileValues[i];
+			}
+			out << "," << result.max << fixed << setprecision(1) << "," << result.average
+				<< "," << result.requestsPerSecond << "," << result.cpuPercentage << endl;
+		}
+		out.unsetf(ios_base::floatfield);
+	}
+
+	if (json) {
+		out << "]" << endl;
+	}
+}
+
+// Receives the pongs of ping's current read
+class IPongReceiver {
+public:
+	virtual void receivePongs(const VLoanedDataSamples& samples) = 0;
+};
+
+// Passes the pongs delivered by the dispatcher to ping, used with the listener receive strategy
+class PongListener : public DataAvailableListenerEx {
+private:
+	IPongReceiver& m_pongReceiver;
+
+public:
+	PongListener(IPongReceiver& pongReceiver) : m_pongReceiver(pongReceiver) {
+	}
+
+	void notifyDataAvailable(VLoanedDataSamples data) {
+		m_pongReceiver.receivePongs(data);
+	}
+};
+
+class Ping : public IPongReceiver {
 private:
+	typedef function<void(const VDataSample&, unsigned long long)> PongHandler;
+
     string m_thingPropertiesUri;
     DataRiver m_dataRiver = createDataRiver();
     ThingEx m_thing = createThing();
 
     ::com::adlinktech::example::protobuf::Ping m_sampleData;
-
+	ExamplePayloadHeader m_header = ExamplePayloadHeader();
+	PingStats m_stats = initPingStats();
+	unsigned long long m_skewedCount = 0;
+	unsigned long long m_intervalStartTime = 0;
+	unsigned long long m_intervalStartCpuTime = 0;
+	unsigned long m_elapsedSeconds = 0;
+	Dispatcher m_dispatcher;
+	PongListener m_pongListener;
+	unique_ptr<ThingEx::SelectorEx> m_pongSelector;
+	vector<string> m_pongIds;
+	unordered_map<unsigned long long, size_t> m_pongIndexes;
+	vector<ExampleTimeStats> m_pongRoundTrips;
+	const PongHandler* m_pongHandler = nullptr;
+	unsigned long long m_readTime = 0;
+	size_t m_readCount = 0;
 
     DataRiver createDataRiver() {
         return DataRiver::getInstance();
@@ -115,140 +465,645 @@ private:
         return m_dataRiver.createThing(tp);
     }
 
-	void waitForPong() {
-		// wait for pong to appear by discovering its thingId and thingClass
-		cout << "# Waiting for pong to run..." << endl;
+	void waitForPongs() {
+		// wait for the pongs to appear by discovering Things of the pong thingClass
+		messageStream() << "# Waiting for " << pongCount << " pong(s) to run..." << endl;
 		auto discoveredThingRegistry = m_dataRiver.getDiscoveredThingRegistry();
-		bool readerFound = false;
+		vector<DiscoveredThing> things;
 
-		while (!readerFound) {
+		while (things.size() < pongCount) {
 			try {
-				// see if we already know pongs's thing class
-				auto thing = discoveredThingRegistry.findDiscoveredThing("pongThing1", "Pong:com.adlinktech.example.protobuf:v1.0");
-				readerFound = true;
+				things = discoveredThingRegistry.findDiscoveredThings("*", "Pong:com.adlinktech.example.protobuf:v1.0");
 			} catch (...) {}
 			this_thread::sleep_for(chrono::seconds(1));
 		}
+
+		// Pong stamps the hash of its Thing id in the payload header of a fan-out ping
+		m_pongIds.clear();
+		m_pongIndexes.clear();
+		for (size_t i = 0; i < pongCount; i++) {
+			m_pongIds.push_back(things[i].getId());
+			m_pongIndexes[exampleHashThingId(things[i].getId())] = i;
+		}
+		if (pongCount > 1) {
+			messageStream() << "# Fan-out to pongs:";
+			for (const string& pongId : m_pongIds) {
+				messageStream() << " " << pongId;
+			}
+			messageStream() << endl;
+		}
+		if (things.size() > pongCount) {
+			messageStream() << "# Found " << things.size() << " pongs, the pongs of the others are ignored" << endl;
+		}
 	}
 
+	// Allocates the payload in one go, it is reused for all pings of this payload size
 	void initPayload(unsigned long payloadSize) {
-	        string p = "a";
-		for (unsigned long i = 0; i < payloadSize; i++) {
-			p = p + "a";
+		m_sampleData.mutable_payload()->assign(payloadSize, 'a');
+	}
+
+	// Pings are written on the default flow of the Thing, unless a flow id was given
+	void writePing() {
+		if (flowId.empty()) {
+			m_thing.write("Ping", m_sampleData);
+		} else {
+			m_thing.write("Ping", flowId, m_sampleData);
 		}
-		m_sampleData.set_payload(p);
 	}
 
+	// Called with the pongs of the current read, directly after the read or by the dispatcher
+	void receivePongs(const VLoanedDataSamples& samples) {
+		m_readTime = exampleNowNanoseconds();
+		for (const VDataSample& sample : samples) {
+			// The listener receives the pongs of all flows
+			if (!flowId.empty() && receiveStrategy == ReceiveStrategy::listener && sample.getFlowId() != flowId) {
+				continue;
+			}
+			(*m_pongHandler)(sample, m_readTime);
+			m_readCount++;
+		}
+	}
+
+	// Waits up to timeout ms for pongs, using the selected receive strategy, and passes each
+	// pong to the handler together with the time it was read. Returns the number of pongs read
+	// and sets readTime to the time of the read.
+	size_t readPongs(int64_t timeout, unsigned long long& readTime, const PongHandler& handler) {
+		unsigned long long readStartTime = exampleNowNanoseconds();
+		m_pongHandler = &handler;
+		m_readCount = 0;
+
+		if (receiveStrategy == ReceiveStrategy::listener) {
+			unsigned long long deadline = readStartTime + timeout * 1000000ULL;
+			do {
+				unsigned long long now = exampleNowNanoseconds();
+				try {
+					m_dispatcher.processEvents((deadline > now) ? (int64_t)((deadline - now) / 1000000) : 0);
+				} catch (TimeoutError e) {
+					// No pongs within timeout
+				}
+			} while (m_readCount == 0 && exampleNowNanoseconds() < deadline);
+		} else if (receiveStrategy == ReceiveStrategy::spin) {
+			unsigned long long deadline = readStartTime + timeout * 1000000ULL;
+			unsigned long backoff = 0;
+			while (true) {
+				VLoanedDataSamples samples = m_pongSelector ?
+					m_pongSelector->read(0) : m_thing.read("Pong", 0);
+				if (samples.size() > 0) {
+					receivePongs(samples);
+					break;
+				}
+				if (exampleNowNanoseconds() >= deadline) {
+					break;
+				}
+				exampleSpinBackoff(backoff, spinBackoff);
+			}
+		} else {
+			VLoanedDataSamples samples = m_pongSelector ?
+				m_pongSelector->read(timeout) : m_thing.read("Pong", timeout);
+			receivePongs(samples);
+		}
+
+		readTime = (m_readCount > 0) ? m_readTime : exampleNowNanoseconds();
+		m_stats.readAccess += readTime - readStartTime;
+
+		return m_readCount;
+	}
+
+	// Writes pings one at a time until the round trip is stable: the medians of the last
+	// WARMUP_STABLE_WINDOWS windows of warmUpWindow ms are within warmUpTolerance percent of
+	// each other. Gives up after warmUpMaxTime seconds.
 	void warmUp() {
-		Timepoint startTime = Clock::now();
+		unsigned long long startTime = exampleNowNanoseconds();
+		unsigned long long windowStartTime = startTime;
+		unsigned long long writeTime;
+		unsigned long long readTime = startTime;
+		unsigned long long sampleCount = 0;
 		int64_t waitTimeout = 10000;
+		ExampleTimeStats window = exampleInitTimeStats();
+		deque<double> medians;
+		bool stable = false;
+		PongHandler ignore = [](const VDataSample& sample, unsigned long long readTime) {};
 
-		cout << "# Warming up 5s to stabilise performance..." << endl;
-		while (Duration<Microseconds>(Clock::now() - startTime) / US_IN_ONE_SEC < 5) {
-			m_thing.write("Ping", m_sampleData);
-                        m_thing.read("Pong", waitTimeout);
+		if (warmUpMaxTime == 0) {
+			return;
+		}
+
+		messageStream() << "# Warming up until the round trip is stable (at most " << warmUpMaxTime << "s)..." << endl;
+		while (!stable && readTime - startTime < warmUpMaxTime * NS_IN_ONE_SEC) {
+			size_t replies = 0;
+			writeTime = exampleNowNanoseconds();
+			writePing();
+			do {
+				replies += readPongs(waitTimeout, readTime, ignore);
+			} while (replies > 0 && replies < pongCount && readTime - writeTime < waitTimeout * 1000000ULL);
+			if (replies > 0) {
+				window += readTime - writeTime;
+				sampleCount++;
+			}
+
+			if (readTime - windowStartTime >= warmUpWindow * 1000000ULL && window.count >= WARMUP_MIN_WINDOW_SAMPLES) {
+				medians.push_back(exampleGetMedianFromTimeStats(window));
+				if (medians.size() > WARMUP_STABLE_WINDOWS) {
+					medians.pop_front();
+				}
+				if (medians.size() == WARMUP_STABLE_WINDOWS) {
+					double lowest = *min_element(medians.begin(), medians.end());
+					double highest = *max_element(medians.begin(), medians.end());
+					stable = highest - lowest <= lowest * warmUpTolerance / 100.0;
+				}
+				exampleResetTimeStats(window);
+				windowStartTime = readTime;
+			}
+		}
+
+		messageStream() << "# Warm up " << (stable ? "complete" : "stopped, round trip not stable,") << " after "
+			<< (readTime - startTime) / 1000000 << " ms and " << sampleCount << " samples";
+		if (!medians.empty()) {
+			messageStream() << " (median " << fixed << setprecision(0) << medians.back() << " ns)";
+		}
+		messageStream() << endl;
+	}
+
+	void writePayloadHeader() {
+		exampleWritePayloadHeader((unsigned char*)&(*m_sampleData.mutable_payload())[0], m_header);
+	}
+
+	bool readPayloadHeader(const VDataSample& sample, ExamplePayloadHeader& header) {
+		::com::adlinktech::example::protobuf::Pong data;
+		sample.get(data);
+		const string& payload = data.payload();
+
+		return exampleReadPayloadHeader((const unsigned char*)payload.data(), payload.size(), header);
+	}
+
+	void startMeasurement() {
+		resetPingStats(m_stats);
+		m_skewedCount = 0;
+		m_pongRoundTrips.assign(m_pongIds.size(), exampleInitTimeStats());
+		m_elapsedSeconds = 0;
+		m_intervalStartTime = exampleNowNanoseconds();
+		m_intervalStartCpuTime = exampleProcessCpuNanoseconds();
+	}
+
+	// Prints the stats of the past second, merges them into the overall stats and resets them
+	// for the next interval. Returns true when the running time has been reached.
+	bool endInterval(unsigned long long now, unsigned long runningTime) {
+		unsigned long long cpuTime = exampleProcessCpuNanoseconds();
+		m_stats.measurementTime = now - m_intervalStartTime;
+		m_stats.cpuTime = cpuTime - m_intervalStartCpuTime;
+		showStats(false, ++m_elapsedSeconds, m_stats);
+
+		overallStats += m_stats;
+		resetPingStats(m_stats);
+		m_intervalStartTime = exampleNowNanoseconds();
+		m_intervalStartCpuTime = cpuTime;
+
+		return runningTime > 0 && m_elapsedSeconds >= runningTime;
+	}
+
+	// Merges the samples of the last (partial) second into the overall stats
+	void endMeasurement() {
+		m_stats.measurementTime = exampleNowNanoseconds() - m_intervalStartTime;
+		m_stats.cpuTime = exampleProcessCpuNanoseconds() - m_intervalStartCpuTime;
+		overallStats += m_stats;
+		resetPingStats(m_stats);
+
+		if (m_skewedCount > 0) {
+			messageStream() << "# Ignored the one-way times of " << m_skewedCount << " pongs without valid timestamps"
+				<< " (pong must use the same clock on the same host)" << endl;
 		}
-		cout << "# Warm up complete" << endl;
 	}
 
+	// Records the one-way times from the timestamps that pong added to the payload header
+	void addOneWayTimes(const ExamplePayloadHeader& header, unsigned long long readTime) {
+		if (header.magic != EXAMPLE_PAYLOAD_INSTRUMENTED || header.pongWriteTime == 0
+				|| header.pongReadTime < header.pingWriteTime
+				|| header.pongWriteTime < header.pongReadTime
+				|| readTime < header.pongWriteTime) {
+			m_skewedCount++;
+			return;
+		}
 
+		m_stats.pingToPong += header.pongReadTime - header.pingWriteTime;
+		m_stats.pongService += header.pongWriteTime - header.pongReadTime;
+		m_stats.pongToPing += readTime - header.pongWriteTime;
+	}
+
+	// Closed loop: write one ping and wait for its pong before writing the next
+	int measure(unsigned long numSamples, unsigned long runningTime) {
+		unsigned long long preWriteTime;
+		unsigned long long postWriteTime;
+		unsigned long long postReadTime;
+		int64_t waitTimeout = 10000;
+		ExamplePayloadHeader header;
+		PongHandler onPong = [&](const VDataSample& sample, unsigned long long readTime) {
+			if (instrumented && readPayloadHeader(sample, header)) {
+				addOneWayTimes(header, readTime);
+			}
+		};
+
+		startMeasurement();
+		for (unsigned long i = 0; !numSamples || i < numSamples; i++) {
+			// Write a sample that pong can send back
+			preWriteTime = exampleNowNanoseconds();
+			if (instrumented) {
+				m_header.pingWriteTime = preWriteTime;
+				writePayloadHeader();
+			}
+			writePing();
+			postWriteTime = exampleNowNanoseconds();
+
+			// Read sample
+			size_t count = readPongs(waitTimeout, postReadTime, onPong);
+
+			// Validate sample count
+			if (count != 1) {
+				cerr << "ERROR: Ping received " << count << " samples but was expecting 1." << endl;
+				return 1;
+			}
+
+			// Update stats
+			m_stats.writeAccess += postWriteTime - preWriteTime;
+			m_stats.roundTrip += postReadTime - preWriteTime;
+
+			// Print stats each second
+			if (postReadTime - m_intervalStartTime > NS_IN_ONE_SEC && endInterval(postReadTime, runningTime)) {
+				break;
+			}
+		}
+		endMeasurement();
+
+		return 0;
+	}
+
+	// Fan-out: write one ping and wait until all pongs have answered it, or until the timeout.
+	// Records the round trip of each pong, the time to the first pong and to the last pong.
+	int measureFanOut(unsigned long numSamples, unsigned long runningTime) {
+		unsigned long long preWriteTime;
+		unsigned long long postWriteTime;
+		unsigned long long postReadTime;
+		int64_t waitTimeout = 10000;
+		vector<bool> replied(pongCount, false);
+		size_t replies = 0;
+		unsigned long long incomplete = 0;
+		unsigned long long unmatched = 0;
+		ExamplePayloadHeader header;
+		PongHandler onPong = [&](const VDataSample& sample, unsigned long long readTime) {
+			if (!readPayloadHeader(sample, header) || header.requestId != m_header.requestId) {
+				unmatched++;
+				return;
+			}
+			auto pong = m_pongIndexes.find(header.pongId);
+			if (pong == m_pongIndexes.end() || replied[pong->second]) {
+				unmatched++;
+				return;
+			}
+
+			replied[pong->second] = true;
+			m_stats.roundTrip += readTime - preWriteTime;
+			m_pongRoundTrips[pong->second] += readTime - preWriteTime;
+			if (replies++ == 0) {
+				m_stats.firstReply += readTime - preWriteTime;
+			}
+			if (replies == pongCount) {
+				m_stats.allReplies += readTime - preWriteTime;
+			}
+			if (instrumented) {
+				addOneWayTimes(header, readTime);
+			}
+		};
+
+		startMeasurement();
+		for (unsigned long i = 0; !numSamples || i < numSamples; i++) {
+			// Write a sample that all pongs send back
+			m_header.requestId++;
+			preWriteTime = exampleNowNanoseconds();
+			m_header.pingWriteTime = preWriteTime;
+			writePayloadHeader();
+			writePing();
+			postWriteTime = exampleNowNanoseconds();
+			m_stats.writeAccess += postWriteTime - preWriteTime;
+
+			// Read the pongs until all pongs answered
+			fill(replied.begin(), replied.end(), false);
+			replies = 0;
+			do {
+				unsigned long long waited = exampleNowNanoseconds() - postWriteTime;
+				int64_t timeout = waitTimeout - (int64_t)(waited / 1000000);
+				readPongs(timeout > 0 ? timeout : 0, postReadTime, onPong);
+			} while (replies < pongCount && postReadTime - postWriteTime < waitTimeout * 1000000ULL);
+
+			if (replies == 0) {
+				cerr << "ERROR: Ping received no pongs for request " << m_header.requestId << "." << endl;
+				return 1;
+			} else if (replies < pongCount) {
+				incomplete++;
+			}
+
+			// Print stats each second
+			if (postReadTime - m_intervalStartTime > NS_IN_ONE_SEC && endInterval(postReadTime, runningTime)) {
+				break;
+			}
+		}
+		endMeasurement();
+
+		if (incomplete > 0) {
+			messageStream() << "# " << incomplete << " pings were not answered by all pongs within " << waitTimeout << " ms" << endl;
+		}
+		if (unmatched > 0) {
+			messageStream() << "# Ignored " << unmatched << " pongs that did not match an outstanding ping" << endl;
+		}
+
+		return 0;
+	}
+
+	void showPongRoundTrips() {
+		messageStream() << COLOR_GREEN << "# Round trip per pong" << NO_COLOR << endl;
+		for (size_t i = 0; i < m_pongIds.size(); i++) {
+			showPercentiles(messageStream(), m_pongIds[i].c_str(), m_pongRoundTrips[i]);
+		}
+	}
+
+	// Windowed: keep up to 'window' pings outstanding and match the pongs by the request id in
+	// the payload header. Request id % window selects the slot of a request, so a new ping is
+	// only written once the ping written 'window' requests before it has been answered.
+	//
+	// With a rate, pings are scheduled on a fixed timeline instead (open loop). A ping that can
+	// only be written after its intended time, because ping was still busy or the window was
+	// full, is written as soon as possible and its round trip is measured from the intended
+	// time. This corrects for coordinated omission: a slow pong cannot hide the latency of the
+	// pings that should have been written in the meantime.
+	int measureWindowed(unsigned long numSamples, unsigned long runningTime, unsigned long window, unsigned long rate) {
+		unsigned long long preWriteTime;
+		unsigned long long postWriteTime;
+		unsigned long long postReadTime;
+		int64_t waitTimeout = 10000;
+		int64_t readTimeout;
+		vector<unsigned long long> slotRequestId(window, 0);
+		vector<unsigned long long> slotIntendedTime(window, 0);
+		vector<unsigned long long> slotWriteTime(window, 0);
+		unsigned long long period = rate ? NS_IN_ONE_SEC / rate : 0;
+		unsigned long long nextRequestId = 1;
+		unsigned long long nextWriteTime;
+		unsigned long long lastProgressTime;
+		unsigned long long written = 0;
+		unsigned long long received = 0;
+		unsigned long long unmatched = 0;
+		unsigned long outstanding = 0;
+		ExamplePayloadHeader header;
+
+		// Match the pongs with the outstanding pings
+		PongHandler onPong = [&](const VDataSample& sample, unsigned long long readTime) {
+			if (!readPayloadHeader(sample, header) || header.requestId == 0
+					|| slotRequestId[header.requestId % window] != header.requestId) {
+				unmatched++;
+				return;
+			}
+
+			size_t slot = header.requestId % window;
+			m_stats.roundTrip += readTime - slotIntendedTime[slot];
+			if (rate) {
+				m_stats.uncorrectedRoundTrip += readTime - slotWriteTime[slot];
+			}
+			if (instrumented) {
+				addOneWayTimes(header, readTime);
+			}
+			slotRequestId[slot] = 0;
+			outstanding--;
+			received++;
+			lastProgressTime = readTime;
+		};
+
+		startMeasurement();
+		nextWriteTime = m_intervalStartTime;
+		lastProgressTime = m_intervalStartTime;
+		while (!numSamples || received < numSamples) {
+			// Fill the window with the pings that are due
+			while (outstanding < window && (!numSamples || written < numSamples)
+					&& slotRequestId[nextRequestId % window] == 0
+					&& (!rate || exampleNowNanoseconds() >= nextWriteTime)) {
+				size_t slot = nextRequestId % window;
+				m_header.requestId = nextRequestId;
+
+				preWriteTime = exampleNowNanoseconds();
+				m_header.pingWriteTime = preWriteTime;
+				writePayloadHeader();
+				writePing();
+				postWriteTime = exampleNowNanoseconds();
+				m_stats.writeAccess += postWriteTime - preWriteTime;
+
+				slotRequestId[slot] = nextRequestId++;
+				slotIntendedTime[slot] = rate ? nextWriteTime : preWriteTime;
+				slotWriteTime[slot] = preWriteTime;
+				if (rate) {
+					m_stats.writeDelay += preWriteTime - nextWriteTime;
+					nextWriteTime += period;
+				}
+				if (outstanding++ == 0) {
+					lastProgressTime = preWriteTime;
+				}
+				written++;
+			}
+
+			// Wait for pongs until the next ping is due
+			readTimeout = waitTimeout;
+			if (rate && outstanding < window && (!numSamples || written < numSamples)) {
+				unsigned long long now = exampleNowNanoseconds();
+				readTimeout = (nextWriteTime > now) ? (int64_t)((nextWriteTime - now) / 1000000) : 0;
+			}
+
+			// Read the pongs that are available
+			size_t count = readPongs(readTimeout, postReadTime, onPong);
+
+			if (count == 0 && outstanding > 0 && postReadTime - lastProgressTime > waitTimeout * 1000000ULL) {
+				cerr << "ERROR: Ping timed out with " << outstanding << " requests outstanding." << endl;
+				return 1;
+			}
+
+			// Print stats each second
+			if (postReadTime - m_intervalStartTime > NS_IN_ONE_SEC && endInterval(postReadTime, runningTime)) {
+				break;
+			}
+		}
+		endMeasurement();
+
+		if (unmatched > 0) {
+			messageStream() << "# Ignored " << unmatched << " pongs that did not match an outstanding ping" << endl;
+		}
+
+		return 0;
+	}
 
 public:
     Ping(string thingPropertiesUri) :
-        m_thingPropertiesUri(thingPropertiesUri)
+        m_thingPropertiesUri(thingPropertiesUri),
+        m_pongListener(*this)
     {
-        cout << "# Ping started" << endl;
+        messageStream() << "# Ping started" << endl;
     }
 
     ~Ping() {
         m_dataRiver.close();
-        cout << "# Ping stopped" << endl;
+        messageStream() << "# Ping stopped" << endl;
     }
 
 	int sendTerminate() {
-        cout << "# Sending termination request." << endl;
+        messageStream() << "# Sending termination request." << endl;
         m_thing.purge("Ping", "ping");
         this_thread::sleep_for(chrono::seconds(1));
 		return 0;
 	}
 
-    int run(unsigned long payloadSize, unsigned long numSamples, unsigned long runningTime) {
-		Timepoint startTime;
-		Timepoint preWriteTime;
-		Timepoint postWriteTime;
-		Timepoint preReadTime;
-		Timepoint postReadTime;
-		int64_t waitTimeout = 10000;
-		ExampleTimeStats roundTrip = exampleInitTimeStats();
-		ExampleTimeStats writeAccess = exampleInitTimeStats();
-		ExampleTimeStats readAccess = exampleInitTimeStats();
+	void showHeader() {
+		// The csv header is written with the first record
+		if (outputFormat != text) {
+			return;
+		}
 
-		cout << "# Parameters: payload size: " << payloadSize << " | number of samples: " << numSamples << " | running time: " << runningTime << endl;
+		cout << "# Round trip measurements (in ns)" << endl;
+		cout << COLOR_LMAGENTA << "#            Round trip time [ns]                                  Write-access time [ns]           Read-access time [ns]";
+		if (instrumented) {
+			cout << "                        One-way median [ns]";
+		}
+		if (openLoop) {
+			cout << "    Uncorrected [ns]  Write delay";
+		}
+		if (pongCount > 1) {
+			cout << "               Fan-out [ns]";
+		}
+		cout << NO_COLOR << endl;
+		cout << COLOR_LMAGENTA << "# Seconds     Count     median        min        p99        max      Count     median        min      Count     median        min  Requests/s";
+		if (instrumented) {
+			cout << "  Ping>pong    Service  Pong>ping";
+		}
+		if (openLoop) {
+			cout << "     median        p99        max";
+		}
+		if (pongCount > 1) {
+			cout << "      first        all    all p99";
+		}
+		cout << "    CPU%" << NO_COLOR << endl;
+	}
 
-                // Wait for the Pong Thing
-		waitForPong();
+	// Measures the round trip for each of the payload sizes. With more than one payload size
+	// (a sweep) the latency-vs-size curve is written to sweepOutput, or to stdout.
+	int run(const vector<unsigned long>& payloadSizes, unsigned long numSamples, unsigned long runningTime, unsigned long window, unsigned long rate,
+			bool sweepJson, const string& sweepOutput) {
+		int result = 0;
+		vector<SweepResult> sweepResults;
+		unsigned long lastPayloadSize = 0;
 
-                // Init payload
-		initPayload(payloadSize);
+		messageStream() << "# Parameters: payload size: " << payloadSizes.front();
+		if (payloadSizes.size() > 1) {
+			messageStream() << ".." << payloadSizes.back() << " (" << payloadSizes.size() << " steps)";
+		}
+		messageStream() << " | number of samples: " << numSamples << " | running time: " << runningTime
+			<< " | window: " << window << " | rate: " << rate << " | instrumented: " << (instrumented ? "yes" : "no")
+			<< " | receive: " << exampleReceiveStrategyName(receiveStrategy) << " | flow: " << (flowId.empty() ? "default" : flowId)
+			<< " | pongs: " << pongCount << endl;
 
-                // Warm-up for 5s
-		warmUp();
+		if (instrumented) {
+			m_header.magic = EXAMPLE_PAYLOAD_INSTRUMENTED;
+		} else if (pongCount > 1) {
+			m_header.magic = EXAMPLE_PAYLOAD_IDENTIFIED;
+		} else {
+			m_header.magic = 0;
+		}
 
-		cout << "# Round trip measurements (in us)" << endl;
-		cout << COLOR_LMAGENTA << "#             Round trip time [us]         Write-access time [us]       Read-access time [us]" << NO_COLOR << endl;
-		cout << COLOR_LMAGENTA << "# Seconds     Count   median      min      Count   median      min      Count   median      min" << NO_COLOR << endl;
+		// Wait for the Pong Things
+		waitForPongs();
 
-                startTime = Clock::now();
-		unsigned long elapsedSeconds = 0;
-		for (unsigned long i = 0; !numSamples || i < numSamples; i++) {
-			// Write a sample that pong can send back
-			preWriteTime = Clock::now();
-			m_thing.write("Ping", m_sampleData);
-                        postWriteTime = Clock::now();
+		unsigned long long startTime = exampleNowNanoseconds();
+		unsigned long long startCpuTime = exampleProcessCpuNanoseconds();
+		vector<ExampleThreadCpu> startThreadCpu;
+		if (scheduling.threadCpu) {
+			startThreadCpu = exampleGetThreadCpuTimes();
+		}
 
-			// Read sample
-			preReadTime = Clock::now();
-			VLoanedDataSamples samples = m_thing.read("Pong", waitTimeout);
-			postReadTime = Clock::now();
+		// With the listener receive strategy the pongs are delivered through the dispatcher,
+		// otherwise only the pongs of ping's own flow are read when a flow id was given
+		if (receiveStrategy == ReceiveStrategy::listener) {
+			m_thing.addListener(m_pongListener, m_dispatcher);
+		} else if (!flowId.empty()) {
+			m_pongSelector.reset(new ThingEx::SelectorEx(m_thing.select("Pong").flow(flowId)));
+		}
 
-			// Validate sample count
-			if (samples.size() != 1) {
-				cerr << "ERROR: Ping received " << samples.size() << " samples but was expecting 1." << endl;
-				return 1;
+		for (size_t step = 0; step < payloadSizes.size() && result == 0; step++) {
+			unsigned long payloadSize = payloadSizes[step];
+
+			// The request id and the timestamps are stored in a header at the start of the payload
+			if ((window > 1 || rate > 0 || instrumented || pongCount > 1) && payloadSize < EXAMPLE_PAYLOAD_HEADER_SIZE) {
+				payloadSize = EXAMPLE_PAYLOAD_HEADER_SIZE;
+				if (step > 0 && payloadSize == lastPayloadSize) {
+					continue;
+				}
+				messageStream() << "# Payload size increased to " << payloadSize << " bytes to fit the payload header" << endl;
 			}
+			lastPayloadSize = payloadSize;
+			currentPayloadSize = payloadSize;
 
-			// Update stats
-			writeAccess += (unsigned long)Duration<Microseconds>(postWriteTime - preWriteTime);
-			readAccess += (unsigned long)Duration<Microseconds>(postReadTime - preReadTime);
-			roundTrip += (unsigned long)Duration<Microseconds>(postReadTime - preWriteTime);
-			writeAccessOverall += (unsigned long)Duration<Microseconds>(postWriteTime - preWriteTime);
-			readAccessOverall += (unsigned long)Duration<Microseconds>(postReadTime - preReadTime);
-			roundTripOverall += (unsigned long)Duration<Microseconds>(postReadTime - preWriteTime);
+			if (payloadSizes.size() > 1) {
+				messageStream() << endl << COLOR_LMAGENTA << "# Payload size: " << payloadSize << " bytes" << NO_COLOR << endl;
+			}
 
-			// Print stats each second
-			if ((Duration<Microseconds>(postReadTime - startTime) > US_IN_ONE_SEC) || (i && i == numSamples)) {
-				// Print stats
-				showStats(false, ++elapsedSeconds, roundTrip, writeAccess, readAccess);
+			// Init payload
+			initPayload(payloadSize);
 
-				// Reset stats for next run
-				exampleResetTimeStats(roundTrip);
-				exampleResetTimeStats(writeAccess);
-				exampleResetTimeStats(readAccess);
+			// Warm-up until the round trip is stable
+			warmUp();
 
-				// Set values for next run
-				startTime = Clock::now();
+			showHeader();
+			if (pongCount > 1) {
+				result = measureFanOut(numSamples, runningTime);
+			} else if (window > 1 || rate > 0) {
+				result = measureWindowed(numSamples, runningTime, window, rate);
+			} else {
+				result = measure(numSamples, runningTime);
+			}
 
-				// Check for timeout
-				if (runningTime > 0 && elapsedSeconds >= runningTime) {
-					break;
+			if (result == 0) {
+				// Print overall stats
+				showStats(true, 0, overallStats);
+				if (pongCount > 1) {
+					showPongRoundTrips();
 				}
+				sweepResults.push_back(getSweepResult(payloadSize, overallStats));
+				resetPingStats(overallStats);
+			}
+		}
+
+		if (scheduling.threadCpu) {
+			unsigned long long roundTrips = 0;
+			for (const SweepResult& sweepResult : sweepResults) {
+				roundTrips += sweepResult.count;
 			}
+			exampleShowThreadCpuTimes(messageStream(), startThreadCpu, exampleGetThreadCpuTimes(),
+				exampleNowNanoseconds() - startTime, exampleProcessCpuNanoseconds() - startCpuTime, roundTrips, "round trips");
 		}
 
-		// Print overall stats
-		showStats(true, 0, roundTripOverall, writeAccessOverall, readAccessOverall);
+		if (receiveStrategy == ReceiveStrategy::listener) {
+			m_thing.removeListener(m_pongListener, m_dispatcher);
+		}
 
-		return 0;
+		if (result == 0 && payloadSizes.size() > 1) {
+			if (sweepOutput.empty()) {
+				// With jsonl or csv the summary records of the sizes already form the curve
+				if (outputFormat == text) {
+					cout << endl << "# Latency vs payload size (round trip in ns)" << endl;
+					writeSweepCurve(cout, sweepJson, sweepResults);
+				}
+			} else {
+				ofstream out(sweepOutput);
+				if (!out) {
+					cerr << "ERROR: Cannot write " << sweepOutput << endl;
+					return 1;
+				}
+				writeSweepCurve(out, sweepJson, sweepResults);
+				messageStream() << "# Latency vs payload size written to " << sweepOutput << endl;
+			}
+		}
+
+		return result;
 	}
 };
 
@@ -257,7 +1112,23 @@ static void GetCommandLineParameters(int argc, char *argv[],
         unsigned long& payloadSize,
         unsigned long& numSamples,
         unsigned long& runningTime,
-	bool& quit
+        unsigned long& window,
+        unsigned long& rate,
+        bool& instrumented,
+		ClockSource& clockSource,
+		ReceiveStrategy& receiveStrategy,
+		unsigned long& spinBackoff,
+		string& flowId,
+		unsigned long& pongCount,
+		unsigned long& warmUpWindow,
+		double& warmUpTolerance,
+		unsigned long& warmUpMaxTime,
+		vector<unsigned long>& payloadSizes,
+		bool& sweepJson,
+		string& sweepOutput,
+		OutputFormat& outputFormat,
+		bool& quit,
+		ExampleSchedulingSettings& scheduling
 ) {
     cxxopts::Options options("ThroughputWriter", "ADLINK ThingSDK ThroughputWriter");
     try {
@@ -265,7 +1136,28 @@ static void GetCommandLineParameters(int argc, char *argv[],
             ("p,payload-size", "Payload size", cxxopts::value<unsigned long>()->default_value("0"))
             ("n,num-samples", "Number of samples (0 is infinite)", cxxopts::value<unsigned long>()->default_value("0"))
             ("r,running-time", "Running Time in seconds (0 is infinite)", cxxopts::value<unsigned long>()->default_value("0"))
-	    ("q,quit", "Send a quit signal to pong", cxxopts::value<bool>())
+            ("w,window", "Maximum number of outstanding pings (0 is 1, or 1000 with a rate)", cxxopts::value<unsigned long>()->default_value("0"))
+            ("rate", "Write pings at a fixed rate in pings/s, independent of the pongs (0 waits for a pong before writing the next ping)", cxxopts::value<unsigned long>()->default_value("0"))
+            ("i,instrumented", "Let pong timestamp the payload to measure one-way times (ping and pong on the same host)", cxxopts::value<bool>())
+            ("c,clock", "Clock used for measurements (steady, tsc)", cxxopts::value<string>()->default_value("steady"))
+            ("receive", "Receive strategy for pongs (blocking, spin, listener)", cxxopts::value<string>()->default_value("blocking"))
+            ("spin-backoff", "Maximum sleep in us between empty polls with the spin receive strategy (0 keeps polling)", cxxopts::value<unsigned long>()->default_value("0"))
+            ("flow-id", "Write pings and read pongs on this flow, to let several pings share a pong", cxxopts::value<string>()->default_value(""))
+            ("pongs", "Number of pongs that answer each ping (fan-out)", cxxopts::value<unsigned long>()->default_value("1"))
+            ("warmup-window", "Length in ms of the windows in which warm-up measures the round trip median", cxxopts::value<unsigned long>()->default_value("100"))
+            ("warmup-tolerance", "Warm-up ends when the last round trip medians differ by at most this percentage", cxxopts::value<double>()->default_value("5"))
+            ("warmup-max", "Maximum warm-up time in seconds (0 disables warm-up)", cxxopts::value<unsigned long>()->default_value("30"))
+            ("sweep-max", "Sweep the payload size from the payload size up to this size (0 measures a single payload size)", cxxopts::value<unsigned long>()->default_value("0"))
+            ("sweep-factor", "Factor between the payload sizes of a sweep", cxxopts::value<double>()->default_value("2"))
+            ("sweep-format", "Format of the latency vs payload size curve (csv, json)", cxxopts::value<string>()->default_value("csv"))
+            ("sweep-output", "File to write the latency vs payload size curve to (default stdout)", cxxopts::value<string>()->default_value(""))
+            ("format", "Output format of the measurements, one record per second and a summary with jsonl and csv (text, jsonl, csv)", cxxopts::value<string>()->default_value("text"))
+			("q,quit", "Send a quit signal to pong", cxxopts::value<bool>())
+            ("cpus", "CPUs to run on, for example 0-3,8", cxxopts::value<string>()->default_value(""))
+            ("numa-nodes", "NUMA nodes to allocate memory from, for example 0 (Linux)", cxxopts::value<string>()->default_value(""))
+            ("fifo-priority", "Run with the SCHED_FIFO scheduling policy at this priority (0 keeps the default policy, Linux)", cxxopts::value<int>()->default_value("0"))
+            ("lock-memory", "Lock all current and future memory with mlockall (Linux)", cxxopts::value<bool>())
+            ("thread-cpu", "Show the CPU time of each thread at the end of the run", cxxopts::value<bool>())
             ("h,help", "Print help")
             ;
         options.parse_positional({"payload-size", "num-samples", "running-time", "other"});
@@ -278,10 +1170,110 @@ static void GetCommandLineParameters(int argc, char *argv[],
             exit(0);
         }
 
-	quit = cmdLineOptions["q"].as<bool>();
+		quit = cmdLineOptions["q"].as<bool>();
         payloadSize = cmdLineOptions["p"].as<unsigned long>();
         numSamples = cmdLineOptions["n"].as<unsigned long>();
         runningTime = cmdLineOptions["r"].as<unsigned long>();
+        window = cmdLineOptions["w"].as<unsigned long>();
+        rate = cmdLineOptions["rate"].as<unsigned long>();
+        instrumented = cmdLineOptions["i"].as<bool>();
+        spinBackoff = cmdLineOptions["spin-backoff"].as<unsigned long>();
+        flowId = cmdLineOptions["flow-id"].as<string>();
+        pongCount = cmdLineOptions["pongs"].as<unsigned long>();
+
+        if (pongCount == 0) {
+            cerr << "Invalid number of pongs" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+        if (pongCount > 1 && (window > 1 || rate > 0)) {
+            cerr << "Fan-out to several pongs writes one ping at a time, it cannot be combined with a window or a rate" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+        sweepOutput = cmdLineOptions["sweep-output"].as<string>();
+        warmUpWindow = cmdLineOptions["warmup-window"].as<unsigned long>();
+        warmUpTolerance = cmdLineOptions["warmup-tolerance"].as<double>();
+        warmUpMaxTime = cmdLineOptions["warmup-max"].as<unsigned long>();
+
+        // A geometric series of payload sizes; a sweep from 0 continues with 1
+        unsigned long sweepMax = cmdLineOptions["sweep-max"].as<unsigned long>();
+        double sweepFactor = cmdLineOptions["sweep-factor"].as<double>();
+        payloadSizes.assign(1, payloadSize);
+        if (sweepMax > payloadSize) {
+            if (sweepFactor <= 1.0) {
+                cerr << "Invalid sweep factor" << endl << endl;
+                cout << options.help({""}) << endl;
+                exit(1);
+            }
+            unsigned long size = payloadSize;
+            while (size < sweepMax) {
+                size = max(size + 1, (unsigned long)(size * sweepFactor));
+                payloadSizes.push_back(min(size, sweepMax));
+            }
+            if (runningTime == 0 && numSamples == 0) {
+                runningTime = 5;
+            }
+        }
+
+        if (cmdLineOptions["sweep-format"].as<string>() == "csv") {
+            sweepJson = false;
+        } else if (cmdLineOptions["sweep-format"].as<string>() == "json") {
+            sweepJson = true;
+        } else {
+            cerr << "Invalid sweep format" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+
+        if (window == 0) {
+            window = (rate > 0) ? 1000 : 1;
+        }
+
+        if (cmdLineOptions["format"].as<string>() == "text") {
+            outputFormat = text;
+        } else if (cmdLineOptions["format"].as<string>() == "jsonl") {
+            outputFormat = jsonl;
+        } else if (cmdLineOptions["format"].as<string>() == "csv") {
+            outputFormat = csv;
+        } else {
+            cerr << "Invalid output format" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+
+        if (cmdLineOptions["c"].as<string>() == "steady") {
+            clockSource = ClockSource::steady;
+        } else if (cmdLineOptions["c"].as<string>() == "tsc") {
+            clockSource = ClockSource::tsc;
+        } else {
+            cerr << "Invalid clock" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+
+        if (cmdLineOptions["receive"].as<string>() == "blocking") {
+            receiveStrategy = ReceiveStrategy::blocking;
+        } else if (cmdLineOptions["receive"].as<string>() == "spin") {
+            receiveStrategy = ReceiveStrategy::spin;
+        } else if (cmdLineOptions["receive"].as<string>() == "listener") {
+            receiveStrategy = ReceiveStrategy::listener;
+        } else {
+            cerr << "Invalid receive strategy" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+
+        if (!exampleParseCpuList(cmdLineOptions["cpus"].as<string>(), scheduling.cpus)
+                || !exampleParseCpuList(cmdLineOptions["numa-nodes"].as<string>(), scheduling.numaNodes)
+                || cmdLineOptions["fifo-priority"].as<int>() < 0) {
+            cerr << "Invalid CPU placement or scheduling settings" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+        scheduling.fifoPriority = cmdLineOptions["fifo-priority"].as<int>();
+        scheduling.lockMemory = cmdLineOptions["lock-memory"].as<bool>();
+        scheduling.threadCpu = cmdLineOptions["thread-cpu"].as<bool>();
     }
     catch (cxxopts::OptionException e) {
         cerr << e.what() << endl << endl;
@@ -292,10 +1284,33 @@ static void GetCommandLineParameters(int argc, char *argv[],
 
 int main(int argc, char *argv[]) {
 	unsigned long payloadSize = 0;
-    	unsigned long numSamples = 0;
-    	unsigned long runningTime = 0;
+    unsigned long numSamples = 0;
+    unsigned long runningTime = 0;
+    unsigned long window = 1;
+    unsigned long rate = 0;
+	ClockSource clockSource = ClockSource::steady;
+	vector<unsigned long> payloadSizes;
+	bool sweepJson = false;
+	string sweepOutput;
 	bool quit = false;
-   	GetCommandLineParameters(argc, argv, payloadSize, numSamples, runningTime, quit);
+   	GetCommandLineParameters(argc, argv, payloadSize, numSamples, runningTime, window, rate, instrumented, clockSource, receiveStrategy, spinBackoff, flowId, pongCount,
+		warmUpWindow, warmUpTolerance, warmUpMaxTime, payloadSizes, sweepJson, sweepOutput, outputFormat, quit, scheduling);
+    openLoop = (rate > 0);
+    pingMode = (pongCount > 1) ? "fan-out" : (openLoop ? "open-loop" : (window > 1 ? "windowed" : "closed-loop"));
+    hostName = exampleHostName();
+    buildInfo = exampleBuildInfo();
+
+    // Initialize the clock used for measurements
+    if (!exampleInitClock(clockSource)) {
+        cerr << "WARNING: No invariant TSC available, using steady clock" << endl;
+    } else if (clockSource == ClockSource::tsc) {
+        messageStream() << "# Using TSC clock (" << fixed << setprecision(3) << 1.0 / exampleTscNanosecondsPerTick << " GHz)" << endl;
+    }
+
+    // Place and schedule the process before the Thing starts its threads, so they inherit it
+    if (!exampleApplySchedulingSettings(scheduling)) {
+        return 1;
+    }
 
     // Register handler for Ctrl-C
     registerControlHandler();
@@ -311,7 +1326,7 @@ int main(int argc, char *argv[]) {
 		if (quit) {
 			result = ping.sendTerminate();
 		} else {
-	        result = ping.run(payloadSize, numSamples, runningTime);
+	        result = ping.run(payloadSizes, numSamples, runningTime, window, rate, sweepJson, sweepOutput);
 		}
     }
     catch (ThingAPIException e)
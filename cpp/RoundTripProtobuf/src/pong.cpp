@@ -25,7 +25,12 @@
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
 
+#include <Dispatcher.hpp>
 #include <JSonThingAPI.hpp>
 #include <ThingAPIException.hpp>
 #include "include/cxxopts.h"
@@ -53,11 +58,106 @@ static void ctrlHandler(int fdwCtrlType)
 }
 #endif
 
-class Pong {
+// Receives the pings that pong has to answer
+class IPingReceiver {
+public:
+    virtual void receivePings(const VLoanedDataSamples& samples) = 0;
+};
+
+// Sends the pong for a ping
+class IPongSender {
+public:
+    virtual void sendPong(const string& flowId, const ::com::adlinktech::example::protobuf::Ping& ping, unsigned long long readTime) = 0;
+};
+
+// A ping queued for an echo thread
+typedef struct PendingPing {
+    string flowId;
+    ::com::adlinktech::example::protobuf::Ping ping;
+    unsigned long long readTime;
+} PendingPing;
+
+// Sends the pongs for the flows assigned to it on its own thread, so the pings of one flow do
+// not wait for the pongs of the other flows that were read before them
+class EchoThread {
+private:
+    IPongSender& m_pongSender;
+    mutex m_mutex;
+    condition_variable m_pingsAvailable;
+    vector<PendingPing> m_pendingPings;
+    bool m_stop = false;
+    thread m_thread;
+
+    void run() {
+        vector<PendingPing> pings;
+        exampleSetThreadName("echo");
+
+        while (true) {
+            {
+                unique_lock<mutex> lock(m_mutex);
+                m_pingsAvailable.wait(lock, [this] { return m_stop || !m_pendingPings.empty(); });
+                if (m_pendingPings.empty()) {
+                    return;
+                }
+                pings.swap(m_pendingPings);
+            }
+
+            for (const PendingPing& ping : pings) {
+                m_pongSender.sendPong(ping.flowId, ping.ping, ping.readTime);
+            }
+            pings.clear();
+        }
+    }
+
+public:
+    EchoThread(IPongSender& pongSender) : m_pongSender(pongSender), m_thread(&EchoThread::run, this) {
+    }
+
+    // Sends the pongs that are still queued before stopping the thread
+    ~EchoThread() {
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_pingsAvailable.notify_one();
+        m_thread.join();
+    }
+
+    void push(const string& flowId, const ::com::adlinktech::example::protobuf::Ping& ping, unsigned long long readTime) {
+        {
+            lock_guard<mutex> lock(m_mutex);
+            m_pendingPings.push_back({ flowId, ping, readTime });
+        }
+        m_pingsAvailable.notify_one();
+    }
+};
+
+// Passes the pings delivered by the dispatcher to pong, used with the listener receive strategy
+class PingListener : public DataAvailableListenerEx {
+private:
+    IPingReceiver& m_pingReceiver;
+
+public:
+    PingListener(IPingReceiver& pingReceiver) : m_pingReceiver(pingReceiver) {
+    }
+
+    void notifyDataAvailable(VLoanedDataSamples data) {
+        m_pingReceiver.receivePings(data);
+    }
+};
+
+class Pong : public IPingReceiver, public IPongSender {
 private:
     string m_thingPropertiesUri;
     DataRiver m_dataRiver = createDataRiver();
     ThingEx m_thing = createThing();
+    ReceiveStrategy m_receiveStrategy;
+    unsigned long m_spinBackoff;
+    bool m_threadCpu;
+    PingListener m_pingListener;
+    vector<unique_ptr<EchoThread> > m_echoThreads;
+    unsigned long long m_pongId = 0;
+    bool m_terminate = false;
 
     DataRiver createDataRiver() {
         return DataRiver::getInstance();
@@ -80,50 +180,237 @@ private:
         return m_dataRiver.createThing(tp);
     }
 
+    // Sends the payload back on the flow of the ping, so several pings can share one pong.
+    // Ping uses the payload to match pongs with pings.
+    void sendPong(const string& flowId, const ::com::adlinktech::example::protobuf::Ping& ping, unsigned long long readTime) {
+        ::com::adlinktech::example::protobuf::Pong pong;
+        pong.set_payload(ping.payload());
+
+        // Add the id of pong, and the read and write time, to the payload header if ping asked for it
+        ExamplePayloadHeader header;
+        string& payload = *pong.mutable_payload();
+        if (exampleReadPayloadHeader((const unsigned char*)payload.data(), payload.size(), header)
+                && (header.magic == EXAMPLE_PAYLOAD_INSTRUMENTED || header.magic == EXAMPLE_PAYLOAD_IDENTIFIED)) {
+            header.pongId = m_pongId;
+            if (header.magic == EXAMPLE_PAYLOAD_INSTRUMENTED) {
+                header.pongReadTime = readTime;
+                header.pongWriteTime = exampleNowNanoseconds();
+            }
+            exampleWritePayloadHeader((unsigned char*)&payload[0], header);
+        }
+        m_thing.write("Pong", flowId, pong);
+    }
+
+    // Sends each ping back to ping, or hands it to the echo thread of its flow
+    void receivePings(const VLoanedDataSamples& samples) {
+        unsigned long long readTime = exampleNowNanoseconds();
+
+        for (const VDataSample& sample : samples) {
+            if (sample.getFlowState() == FlowState::PURGED) {
+                cout << "Received termination request. Terminating." << endl;
+                m_terminate = true;
+                break;
+            }
+
+            ::com::adlinktech::example::protobuf::Ping ping;
+            sample.get(ping);
+            string flowId = sample.getFlowId();
+            if (m_echoThreads.empty()) {
+                sendPong(flowId, ping, readTime);
+            } else {
+                m_echoThreads[hash<string>()(flowId) % m_echoThreads.size()]->push(flowId, ping, readTime);
+            }
+        }
+    }
+
 public:
-    Pong(string thingPropertiesUri) :
-        m_thingPropertiesUri(thingPropertiesUri)
+    Pong(string thingPropertiesUri, ReceiveStrategy receiveStrategy, unsigned long spinBackoff, unsigned long echoThreads, bool threadCpu) :
+        m_thingPropertiesUri(thingPropertiesUri),
+        m_receiveStrategy(receiveStrategy),
+        m_spinBackoff(spinBackoff),
+        m_threadCpu(threadCpu),
+        m_pingListener(*this)
     {
+        // The listener reads the pings on the dispatcher thread, the echo threads send the pongs.
+        // A flow is always handled by the same echo thread, so its pongs stay in order.
+        if (m_receiveStrategy == ReceiveStrategy::listener && echoThreads > 1) {
+            for (unsigned long i = 0; i < echoThreads; i++) {
+                m_echoThreads.push_back(unique_ptr<EchoThread>(new EchoThread(*this)));
+            }
+        }
+        m_pongId = exampleHashThingId(m_thing.getId());
         cout << "Pong started" << endl;
     }
 
     ~Pong() {
+        m_echoThreads.clear();
         m_dataRiver.close();
         cout << "Pong stopped" << endl;
     }
 
     int run() {
-        bool terminate = false;
-        cout << "Waiting for samples from ping to send back..." << endl;
-
-        while (!terminate) {        	
-
-            VLoanedDataSamples samples = m_thing.read("Ping");
+        unsigned long long startTime = exampleNowNanoseconds();
+        unsigned long long startCpuTime = exampleProcessCpuNanoseconds();
+        vector<ExampleThreadCpu> startThreadCpu;
+        if (m_threadCpu) {
+            startThreadCpu = exampleGetThreadCpuTimes();
+        }
+        cout << "Waiting for samples from ping to send back (" << exampleReceiveStrategyName(m_receiveStrategy) << " receive";
+        if (!m_echoThreads.empty()) {
+            cout << ", " << m_echoThreads.size() << " echo threads";
+        }
+        cout << ")..." << endl;
 
-            for (const VDataSample& sample : samples) {
-            	if (sample.getFlowState() == FlowState::PURGED) {
-                    cout << "Received termination request. Terminating." << endl;
-                    terminate = true;
-                    break;
+        if (m_receiveStrategy == ReceiveStrategy::listener) {
+            Dispatcher dispatcher;
+            m_thing.addListener(m_pingListener, dispatcher);
+            while (!m_terminate) {
+                try {
+                    dispatcher.processEvents(1000);
+                } catch (TimeoutError e) {
+                    // No pings within timeout
+                }
+            }
+            m_thing.removeListener(m_pingListener, dispatcher);
+        } else if (m_receiveStrategy == ReceiveStrategy::spin) {
+            unsigned long backoff = 0;
+            while (!m_terminate) {
+                VLoanedDataSamples samples = m_thing.read("Ping", 0);
+                if (samples.size() > 0) {
+                    backoff = 0;
+                    receivePings(samples);
                 } else {
-                    ::com::adlinktech::example::protobuf::Ping data;
-                    m_thing.write("Pong",  data);                	
+                    exampleSpinBackoff(backoff, m_spinBackoff);
                 }
             }
+        } else {
+            while (!m_terminate) {
+                VLoanedDataSamples samples = m_thing.read("Ping");
+                receivePings(samples);
+            }
+        }
+
+        unsigned long long elapsedTime = exampleNowNanoseconds() - startTime;
+        unsigned long long cpuTime = exampleProcessCpuNanoseconds() - startCpuTime;
+        cout << "CPU time: " << cpuTime / 1000000 << " ms in " << elapsedTime / 1000000 << " ms ("
+            << (elapsedTime ? cpuTime * 100 / elapsedTime : 0) << "% of one core)" << endl;
+        if (m_threadCpu) {
+            exampleShowThreadCpuTimes(cout, startThreadCpu, exampleGetThreadCpuTimes(), elapsedTime, cpuTime, 0, "");
         }
 
+        // Send the pongs that are still queued, with the listener receive strategy
+        m_echoThreads.clear();
+
         return 0;
     }
 };
 
 
+static void GetCommandLineParameters(int argc, char *argv[],
+        string& thingPropertiesUri,
+        ClockSource& clockSource,
+        ReceiveStrategy& receiveStrategy,
+        unsigned long& spinBackoff,
+        unsigned long& echoThreads,
+        ExampleSchedulingSettings& scheduling
+) {
+    cxxopts::Options options("Pong", "ADLINK ThingSDK Pong");
+    try {
+        options.add_options()
+            ("thing", "Thing properties URI, each pong of a fan-out needs its own Thing id", cxxopts::value<string>()->default_value("file://./config/PongProperties.json"))
+            ("c,clock", "Clock used for the timestamps of an instrumented ping (steady, tsc)", cxxopts::value<string>()->default_value("steady"))
+            ("receive", "Receive strategy for pings (blocking, spin, listener)", cxxopts::value<string>()->default_value("blocking"))
+            ("spin-backoff", "Maximum sleep in us between empty polls with the spin receive strategy (0 keeps polling)", cxxopts::value<unsigned long>()->default_value("0"))
+            ("t,threads", "Number of threads sending pongs with the listener receive strategy, pings are assigned to a thread by flow id (1 sends from the dispatcher thread)", cxxopts::value<unsigned long>()->default_value("1"))
+            ("cpus", "CPUs to run on, for example 0-3,8", cxxopts::value<string>()->default_value(""))
+            ("numa-nodes", "NUMA nodes to allocate memory from, for example 0 (Linux)", cxxopts::value<string>()->default_value(""))
+            ("fifo-priority", "Run with the SCHED_FIFO scheduling policy at this priority (0 keeps the default policy, Linux)", cxxopts::value<int>()->default_value("0"))
+            ("lock-memory", "Lock all current and future memory with mlockall (Linux)", cxxopts::value<bool>())
+            ("thread-cpu", "Show the CPU time of each thread at the end of the run", cxxopts::value<bool>())
+            ("h,help", "Print help")
+            ;
+
+        auto cmdLineOptions = options.parse(argc, argv);
+
+        if (cmdLineOptions.count("help")) {
+            cout << options.help({""}) << endl;
+            exit(0);
+        }
+
+        thingPropertiesUri = cmdLineOptions["thing"].as<string>();
+
+        if (cmdLineOptions["c"].as<string>() == "steady") {
+            clockSource = ClockSource::steady;
+        } else if (cmdLineOptions["c"].as<string>() == "tsc") {
+            clockSource = ClockSource::tsc;
+        } else {
+            cerr << "Invalid clock" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+
+        if (cmdLineOptions["receive"].as<string>() == "blocking") {
+            receiveStrategy = ReceiveStrategy::blocking;
+        } else if (cmdLineOptions["receive"].as<string>() == "spin") {
+            receiveStrategy = ReceiveStrategy::spin;
+        } else if (cmdLineOptions["receive"].as<string>() == "listener") {
+            receiveStrategy = ReceiveStrategy::listener;
+        } else {
+            cerr << "Invalid receive strategy" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+        spinBackoff = cmdLineOptions["spin-backoff"].as<unsigned long>();
+        echoThreads = cmdLineOptions["t"].as<unsigned long>();
+        if (!exampleParseCpuList(cmdLineOptions["cpus"].as<string>(), scheduling.cpus)
+                || !exampleParseCpuList(cmdLineOptions["numa-nodes"].as<string>(), scheduling.numaNodes)
+                || cmdLineOptions["fifo-priority"].as<int>() < 0) {
+            cerr << "Invalid CPU placement or scheduling settings" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+        scheduling.fifoPriority = cmdLineOptions["fifo-priority"].as<int>();
+        scheduling.lockMemory = cmdLineOptions["lock-memory"].as<bool>();
+        scheduling.threadCpu = cmdLineOptions["thread-cpu"].as<bool>();
+
+        if (echoThreads > 1 && receiveStrategy != ReceiveStrategy::listener) {
+            cerr << "Multiple threads require the listener receive strategy" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+    }
+    catch (cxxopts::OptionException e) {
+        cerr << e.what() << endl << endl;
+        cout << options.help({""}) << endl;
+        exit(1);
+    }
+}
+
 int main(int argc, char *argv[]) {
+    string thingPropertiesUri;
+    ClockSource clockSource = ClockSource::steady;
+    ReceiveStrategy receiveStrategy = ReceiveStrategy::blocking;
+    unsigned long spinBackoff = 0;
+    unsigned long echoThreads = 1;
+    ExampleSchedulingSettings scheduling;
+    GetCommandLineParameters(argc, argv, thingPropertiesUri, clockSource, receiveStrategy, spinBackoff, echoThreads, scheduling);
+
+    // Place and schedule the process before the Thing starts its threads, so they inherit it
+    if (!exampleApplySchedulingSettings(scheduling)) {
+        return 1;
+    }
+
+    // Initialize the clock used for timestamps
+    if (!exampleInitClock(clockSource)) {
+        cerr << "WARNING: No invariant TSC available, using steady clock" << endl;
+    }
+
     // Register handler for Ctrl-C
     registerControlHandler();
 
     try
     {
-        return Pong("file://./config/PongProperties.json").run();
+        return Pong(thingPropertiesUri, receiveStrategy, spinBackoff, echoThreads, scheduling.threadCpu).run();
     }
     catch (ThingAPIException e)
     {
@@ -25,6 +25,7 @@
 #include <atomic>
 #include <chrono>
 #include <cstring>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <map>
@@ -34,6 +35,7 @@
 #include <thread>
 #include <time.h>
 
+#include <Dispatcher.hpp>
 #include <IoTDataThing.hpp>
 #include <JSonThingAPI.hpp>
 #include <ThingAPIException.hpp>
@@ -44,49 +46,383 @@ using namespace std;
 using namespace com::adlinktech::datariver;
 using namespace com::adlinktech::iot;
 
-unsigned long long sampleCount = 0;
-unsigned long long startCount = 0;
+// Counters of the receive thread, which it publishes to the reporter thread after each batch
+typedef struct ReaderCounters {
+    unsigned long long samples;
+    // Logical records, a sample of a batching writer holds several records
+    unsigned long long records;
+    unsigned long long bytes;
+    // Lost, reordered, late and duplicate samples of all flows
+    ExampleSequenceCounts sequence;
+    unsigned long long batches;
+    unsigned long long batchMaxSize;
+    // Payload size of the last sample
+    unsigned long long payloadSize;
+} ReaderCounters;
+
 static Timepoint currentTime = Timepoint();
 static Timepoint startTime = Timepoint();
-static unsigned long long bytesReceived = 0;
-static unsigned long long outOfOrderCount = 0;
-static unsigned long long batchCount = 0;
-static unsigned long long batchMaxSize = 0;
+// Process CPU time in ns at the start time
+static unsigned long long startCpuTime = 0;
+// End-to-end latency of the samples that carry a send timestamp
+static ExampleTimeStats latencyStats = exampleInitTimeStats();
+
+// Interval in ms at which the reporter thread checks the published counters
+#define REPORT_POLL_INTERVAL 10
+
+// Interval in ms at which the reader sends feedback for the flows of a throughput search
+#define FEEDBACK_INTERVAL 100
+
+// Reception statistics of a flow of the throughput search, sent back to the writer
+typedef struct FlowFeedback {
+    unsigned long long received;
+    ExampleSequenceCounts sequence;
+    ExampleTimeStats latency;
+    bool changed;
+} FlowFeedback;
+
+// Sequence numbers of a writer flow; each step of a payload size sweep has its own flows
+typedef struct FlowSequence {
+    ExampleSequenceTracker tracker;
+    unsigned long long payloadSize;
+} FlowSequence;
+
+// Reception statistics of one payload size, reported after a payload size sweep
+typedef struct SizeStats {
+    unsigned long long samples;
+    unsigned long long bytes;
+    ExampleSequenceCounts sequence;
+    unsigned long long batches;
+    unsigned long long batchMaxSize;
+    unsigned long long firstReadTime;
+    unsigned long long lastReadTime;
+} SizeStats;
+
+static map<unsigned long long, SizeStats> sizeStats;
+
+// Set when the payload size varies within a sweep step, e.g. with a size distribution; the
+// statistics per payload size then do not describe a single size and are not shown
+static bool payloadSizesVary = false;
+static bool sweepJson = false;
+static string sweepOutput;
+
+// Throughput timeline of short intervals, written at exit to find stalls
+static string timelineOutput;
+static unsigned long timelineBucket = 10;
+static unsigned long timelineLength = 600;
+
+// QoS profile of the ThroughputTagGroup, recorded with the machine-readable output
+#define THROUGHPUT_QOS_PROFILE "event"
+
+// Receive strategy of the reader:
+//    readAll = read the samples of all flows with a timeout
+//    readNext = read only the samples that were not read before (read_next)
+//    selector = read through a selector on the flow ids of the writers
+//    listener = a DataAvailableListener, called by a Dispatcher on the reading thread
+enum ReaderMode {
+    readAll,
+    readNext,
+    selector,
+    listener
+};
+
+static const char* getReaderModeName(ReaderMode readerMode) {
+    switch (readerMode) {
+    case ReaderMode::readNext:
+        return "read_next";
+    case ReaderMode::selector:
+        return "selector";
+    case ReaderMode::listener:
+        return "listener";
+    default:
+        return "read";
+    }
+}
+
+static ReaderMode readerMode = ReaderMode::readAll;
+static OutputFormat outputFormat = text;
+static string writerModeLabel;
+static string hostName;
+static string buildInfo;
+static ExampleSchedulingSettings scheduling;
+
+// Progress and status messages; with jsonl and csv, stdout only carries the records
+static ostream& messageStream() {
+    return (outputFormat == text) ? cout : cerr;
+}
+
+static void addBatchToSizeStats(SizeStats* stats, unsigned long long samples) {
+    if (stats != nullptr && samples > 0) {
+        stats->batches++;
+        if (samples > stats->batchMaxSize) {
+            stats->batchMaxSize = samples;
+        }
+    }
+}
+
+static void writeSizeTable(ostream& out, bool json) {
+    if (json) {
+        out << "[" << endl;
+    } else {
+        out << "payload_size,samples,bytes,samples_per_sec,mbit_per_sec,lost,loss_percentage,reordered,late,duplicate,max_gap,batches,avg_batch_size,max_batch_size" << endl;
+    }
+
+    size_t i = 0;
+    for (const auto& size : sizeStats) {
+        const SizeStats& stats = size.second;
+        double duration = (double)(stats.lastReadTime - stats.firstReadTime) / NS_IN_ONE_SEC;
+        double samplesPerSecond = (duration > 0) ? stats.samples / duration : 0;
+        double mbitPerSecond = (duration > 0) ? ((double)stats.bytes / BYTES_PER_SEC_TO_MEGABITS_PER_SEC) / duration : 0;
+        const ExampleSequenceCounts& sequence = stats.sequence;
+        double loss = 100.0 * sequence.lost / (stats.samples - sequence.duplicate + sequence.lost);
+        double batchSize = (stats.batches > 0) ? (double)stats.samples / stats.batches : 0;
+
+        out << fixed;
+        if (json) {
+            out << "  { \"payload_size\": " << size.first << ", \"samples\": " << stats.samples << ", \"bytes\": " << stats.bytes
+                << setprecision(0) << ", \"samples_per_sec\": " << samplesPerSecond
+                << setprecision(2) << ", \"mbit_per_sec\": " << mbitPerSecond
+                << ", \"lost\": " << sequence.lost << ", \"loss_percentage\": " << loss
+                << ", \"reordered\": " << sequence.reordered << ", \"late\": " << sequence.late
+                << ", \"duplicate\": " << sequence.duplicate << ", \"max_gap\": " << sequence.maxGap
+                << ", \"batches\": " << stats.batches << setprecision(1) << ", \"avg_batch_size\": " << batchSize
+                << ", \"max_batch_size\": " << stats.batchMaxSize
+                << " }" << (++i < sizeStats.size() ? "," : "") << endl;
+        } else {
+            out << size.first << "," << stats.samples << "," << stats.bytes
+                << setprecision(0) << "," << samplesPerSecond << setprecision(2) << "," << mbitPerSecond
+                << "," << sequence.lost << "," << loss << "," << sequence.reordered << "," << sequence.late
+                << "," << sequence.duplicate << "," << sequence.maxGap << "," << stats.batches
+                << setprecision(1) << "," << batchSize << "," << stats.batchMaxSize << endl;
+        }
+        out.unsetf(ios_base::floatfield);
+    }
 
-static void showSummary() {
+    if (json) {
+        out << "]" << endl;
+    }
+}
+
+static void addLatency(const unsigned char* payload, size_t payloadSize, unsigned long long readTime,
+        ExampleTimeStats& intervalLatency, FlowFeedback* feedback) {
+    unsigned long long sendTime;
+    if (exampleReadPayloadTimestamp(payload, payloadSize, sendTime) && readTime >= sendTime) {
+        intervalLatency += readTime - sendTime;
+        if (feedback) {
+            feedback->latency += readTime - sendTime;
+        }
+    }
+}
+
+// Adds the latency of the records in a payload, and returns the number of records. The records of
+// a batch are read in place.
+static unsigned long long addRecords(const unsigned char* payload, size_t payloadSize, unsigned long long readTime,
+        ExampleTimeStats& intervalLatency, FlowFeedback* feedback) {
+    ExampleBatchReader batch;
+    if (!exampleStartBatchReader(batch, payload, payloadSize)) {
+        addLatency(payload, payloadSize, readTime, intervalLatency, feedback);
+        return 1;
+    }
+
+    const unsigned char* record;
+    size_t recordSize;
+    unsigned long long records = 0;
+    while (exampleNextBatchRecord(batch, record, recordSize)) {
+        addLatency(record, recordSize, readTime, intervalLatency, feedback);
+        records++;
+    }
+
+    return records;
+}
+
+static string getLatencyPercentiles(const ExampleTimeStats& stats) {
+    ostringstream percentiles;
+    percentiles << fixed << setprecision(1)
+        << "p50 " << (double)exampleGetPercentileFromTimeStats(stats, 50.0) / NS_IN_ONE_US << " us, "
+        << "p99 " << (double)exampleGetPercentileFromTimeStats(stats, 99.0) / NS_IN_ONE_US << " us, "
+        << "p99.9 " << (double)exampleGetPercentileFromTimeStats(stats, 99.9) / NS_IN_ONE_US << " us";
+
+    return percentiles.str();
+}
+
+static void writeRecordHeader() {
+    if (outputFormat == csv) {
+        cout << "type,seconds,host,payload_size,writer_mode,qos_profile,build,samples,bytes,lost,reordered,late,duplicate,max_gap,"
+                "reader_mode,samples_per_sec,mbit_per_sec,avg_batch_size,max_batch_size,cpu_percentage,"
+                "latency_count,latency_p50_us,latency_p99_us,latency_p999_us,records,records_per_sec" << endl;
+    }
+}
+
+// Writes one interval or summary record in the jsonl or csv output format
+static void writeRecord(const ReaderCounters& counters, const string& type, double seconds, double samplesPerSecond, double recordsPerSecond,
+        double mbitPerSecond, const ExampleTimeStats& latency, double cpuPercentage) {
+    double batchSize = (counters.batches > 0) ? (double)counters.samples / counters.batches : 0;
+    double p50 = (double)exampleGetPercentileFromTimeStats(latency, 50.0) / NS_IN_ONE_US;
+    double p99 = (double)exampleGetPercentileFromTimeStats(latency, 99.0) / NS_IN_ONE_US;
+    double p999 = (double)exampleGetPercentileFromTimeStats(latency, 99.9) / NS_IN_ONE_US;
+
+    cout << fixed;
+    if (outputFormat == jsonl) {
+        cout << "{\"type\":" << exampleJsonString(type)
+                << setprecision(3) << ",\"seconds\":" << seconds
+                << ",\"host\":" << exampleJsonString(hostName)
+                << ",\"payload_size\":" << counters.payloadSize
+                << ",\"writer_mode\":" << exampleJsonString(writerModeLabel)
+                << ",\"qos_profile\":" << exampleJsonString(THROUGHPUT_QOS_PROFILE)
+                << ",\"build\":" << exampleJsonString(buildInfo)
+                << ",\"samples\":" << counters.samples << ",\"bytes\":" << counters.bytes
+                << ",\"lost\":" << counters.sequence.lost << ",\"reordered\":" << counters.sequence.reordered
+                << ",\"late\":" << counters.sequence.late << ",\"duplicate\":" << counters.sequence.duplicate
+                << ",\"max_gap\":" << counters.sequence.maxGap
+                << ",\"reader_mode\":" << exampleJsonString(getReaderModeName(readerMode))
+                << setprecision(0) << ",\"samples_per_sec\":" << samplesPerSecond
+                << setprecision(2) << ",\"mbit_per_sec\":" << mbitPerSecond
+                << setprecision(1) << ",\"avg_batch_size\":" << batchSize
+                << ",\"max_batch_size\":" << counters.batchMaxSize
+                << ",\"cpu_percentage\":" << cpuPercentage
+                << ",\"latency_count\":" << latency.count
+                << ",\"latency_p50_us\":" << p50 << ",\"latency_p99_us\":" << p99 << ",\"latency_p999_us\":" << p999
+                << ",\"records\":" << counters.records << setprecision(0) << ",\"records_per_sec\":" << recordsPerSecond
+                << "}" << endl;
+    } else {
+        cout << type << setprecision(3) << "," << seconds << "," << hostName << "," << counters.payloadSize << ","
+                << writerModeLabel << "," << THROUGHPUT_QOS_PROFILE << "," << buildInfo << ","
+                << counters.samples << "," << counters.bytes << "," << counters.sequence.lost << "," << counters.sequence.reordered << ","
+                << counters.sequence.late << "," << counters.sequence.duplicate << "," << counters.sequence.maxGap << ","
+                << getReaderModeName(readerMode) << ","
+                << setprecision(0) << samplesPerSecond << "," << setprecision(2) << mbitPerSecond << ","
+                << setprecision(1) << batchSize << "," << counters.batchMaxSize << "," << cpuPercentage << ","
+                << latency.count << "," << p50 << "," << p99 << "," << p999 << ","
+                << counters.records << "," << setprecision(0) << recordsPerSecond << endl;
+    }
+    cout.unsetf(ios_base::floatfield);
+}
+
+static void showSummary(const ReaderCounters& counters) {
     // Output totals and averages
-    if (batchCount > 0) {
+    if (counters.batches > 0) {
         double deltaTime = (double)Duration<Microseconds>(currentTime - startTime) / US_IN_ONE_SEC;
-        cout << endl << fixed
-                    << "Total received: " << sampleCount << " samples, " << bytesReceived << " bytes" << endl
-                    << "Out of order: " << outOfOrderCount << " samples" << endl
-                    << "Average transfer rate: "
-                            << setprecision(0) << (double)sampleCount / deltaTime << " samples/s, "
-                            << setprecision(2) << ((double)bytesReceived / BYTES_PER_SEC_TO_MEGABITS_PER_SEC) / deltaTime << " Mbit/s"
-                    << endl
-                    << "Average sample-count per batch: " << sampleCount / batchCount << ", maximum batch-size: " << batchMaxSize << endl;
+        double cpuTime = (double)(exampleProcessCpuNanoseconds() - startCpuTime) / NS_IN_ONE_SEC;
+        if (outputFormat != text) {
+            writeRecord(counters, "summary", deltaTime, (double)counters.samples / deltaTime, (double)counters.records / deltaTime,
+                    ((double)counters.bytes / BYTES_PER_SEC_TO_MEGABITS_PER_SEC) / deltaTime, latencyStats, cpuTime * 100 / deltaTime);
+        } else {
+            cout << endl << fixed
+                        << "Total received: " << counters.samples << " samples, " << counters.bytes << " bytes" << endl
+                        << "Lost: " << counters.sequence.lost << " samples, maximum gap: " << counters.sequence.maxGap << " samples" << endl
+                        << "Reordered: " << counters.sequence.reordered << ", late: " << counters.sequence.late
+                                << ", duplicate: " << counters.sequence.duplicate << " samples" << endl
+                        << "Average transfer rate: "
+                                << setprecision(0) << (double)counters.samples / deltaTime << " samples/s, "
+                                << setprecision(2) << ((double)counters.bytes / BYTES_PER_SEC_TO_MEGABITS_PER_SEC) / deltaTime << " Mbit/s"
+                        << endl
+                        << "Average sample-count per batch: " << counters.samples / counters.batches << ", maximum batch-size: " << counters.batchMaxSize << endl
+                        << "CPU time with " << getReaderModeName(readerMode) << " reader: "
+                                << setprecision(0) << cpuTime * 1000 << " ms, "
+                                << setprecision(1) << cpuTime * 100 / deltaTime << "% of one core, "
+                                << setprecision(0) << (counters.samples > 0 ? cpuTime * NS_IN_ONE_SEC / counters.samples : 0.0) << " ns per sample" << endl;
+            if (counters.records != counters.samples) {
+                cout << "Records: " << counters.records << ", "
+                        << setprecision(0) << (double)counters.records / deltaTime << " records/s, "
+                        << setprecision(1) << (double)counters.records / counters.samples << " records per sample" << endl;
+            }
+            if (latencyStats.count > 0) {
+                cout << "Latency: " << getLatencyPercentiles(latencyStats)
+                        << setprecision(1) << ", min " << (double)latencyStats.min / NS_IN_ONE_US << " us"
+                        << ", avg " << latencyStats.average / NS_IN_ONE_US << " us"
+                        << ", max " << (double)latencyStats.max / NS_IN_ONE_US << " us" << endl;
+            }
+        }
+
+        // Show the statistics per payload size after a sweep
+        if (payloadSizesVary) {
+            if (!sweepOutput.empty()) {
+                cerr << "Payload sizes vary within a flow, no statistics per payload size written to " << sweepOutput << endl;
+            }
+        } else if (sizeStats.size() > 1 || !sweepOutput.empty()) {
+            if (sweepOutput.empty()) {
+                // The records on stdout stay machine-readable, the size table then needs --sweep-output
+                if (outputFormat == text) {
+                    cout << endl;
+                    writeSizeTable(cout, sweepJson);
+                }
+            } else {
+                ofstream out(sweepOutput);
+                if (!out) {
+                    cerr << "ERROR: Cannot write " << sweepOutput << endl;
+                } else {
+                    writeSizeTable(out, sweepJson);
+                    messageStream() << "Statistics per payload size written to " << sweepOutput << endl;
+                }
+            }
+        }
     }
 }
 
 #ifdef _WIN32
 static bool ctrlHandler(DWORD fdwCtrlType)
 {
-    showSummary();
-    ExitProcess(1);
+    // The reader stops, and shows the summary on its own thread
+    stop = true;
+    return true;
 }
 #else
 static void ctrlHandler(int fdwCtrlType)
 {
-    showSummary();
-    exit(1);
+    // The reader stops, and shows the summary on its own thread
+    stop = true;
 }
 #endif
 
-class ThroughputReader {
+// Receives the samples of the reader
+class ISampleReceiver {
+public:
+    virtual void receiveSamples(const vector<DataSample<IOT_NVP_SEQ> >& samples, unsigned long long readTime) = 0;
+};
+
+// Passes the samples delivered by the dispatcher to the reader, used with the listener reader mode
+class SampleListener : public DataAvailableListener<IOT_NVP_SEQ> {
+private:
+    ISampleReceiver& m_sampleReceiver;
+
+public:
+    SampleListener(ISampleReceiver& sampleReceiver) : m_sampleReceiver(sampleReceiver) {
+    }
+
+    void notifyDataAvailable(const vector<DataSample<IOT_NVP_SEQ> >& data) {
+        m_sampleReceiver.receiveSamples(data, exampleNowNanoseconds());
+    }
+};
+
+class ThroughputReader : public ISampleReceiver {
 private:
     string m_thingPropertiesUri;
     DataRiver m_dataRiver = createDataRiver();
     Thing m_thing = createThing();
+    map<string, FlowFeedback> m_feedback;
+    Timepoint m_lastFeedbackTime = Clock::now();
+    Dispatcher m_dispatcher;
+    SampleListener m_sampleListener;
+    // Last received sequence numbers for each writer flow
+    map<string, FlowSequence> m_flowSequences;
+    // Statistics of the payload size of the last sample, and its samples in the current batch
+    SizeStats* m_sizeEntry = nullptr;
+    unsigned long long m_sizeEntryPayloadSize = 0;
+    unsigned long long m_sizeBatchSamples = 0;
+    unsigned long long m_payloadSize = 0;
+    // Counters of the receive thread, and the copy it publishes for the reporter thread
+    ReaderCounters m_counters = ReaderCounters();
+    ExampleSeqlock<ReaderCounters> m_publishedCounters;
+    // The receive thread records the latency in the active interval histogram, which the reporter
+    // thread swaps once a second. The receive thread marks the histogram it records in, or -1.
+    ExampleTimeStats m_intervalLatencyStats[2] = { exampleInitTimeStats(), exampleInitTimeStats() };
+    alignas(EXAMPLE_CACHE_LINE_SIZE) atomic<int> m_activeLatencyStats;
+    alignas(EXAMPLE_CACHE_LINE_SIZE) atomic<int> m_latencyStatsInUse;
+    // Samples and bytes of each timeline bucket, kept by the receive thread
+    ExampleTimeline m_timeline;
+    // Seconds reported by the reporter thread
+    alignas(EXAMPLE_CACHE_LINE_SIZE) atomic<unsigned long long> m_cycles;
+    atomic<bool> m_flowPurged;
 
     DataRiver createDataRiver() {
         return DataRiver::getInstance();
@@ -96,6 +432,7 @@ private:
         // Create and Populate the TagGroup registry with JSON resource files.
         JSonTagGroupRegistry tgr;
         tgr.registerTagGroupsFromURI("file://definitions/TagGroup/com.adlinktech.example/ThroughputTagGroup.json");
+        tgr.registerTagGroupsFromURI("file://definitions/TagGroup/com.adlinktech.example/ThroughputFeedbackTagGroup.json");
         m_dataRiver.addTagGroupRegistry(tgr);
 
         // Create and Populate the ThingClass registry with JSON resource files.
@@ -110,129 +447,371 @@ private:
         return m_dataRiver.createThing(tp);
     }
 
-public:
-    ThroughputReader(string thingPropertiesUri) :
-            m_thingPropertiesUri(thingPropertiesUri) {
-        cout << "Throughput reader started" << endl;
+    // Returns the feedback of a flow of the throughput search, or null for other flows
+    FlowFeedback* getFlowFeedback(const string& flowId) {
+        if (flowId.find(EXAMPLE_SEARCH_FLOW_TAG) == string::npos) {
+            return nullptr;
+        }
+
+        auto feedback = m_feedback.find(flowId);
+        if (feedback == m_feedback.end()) {
+            FlowFeedback newFeedback;
+            newFeedback.received = 0;
+            newFeedback.sequence = ExampleSequenceCounts();
+            newFeedback.latency = exampleInitTimeStats();
+            newFeedback.changed = false;
+            feedback = m_feedback.insert(make_pair(flowId, newFeedback)).first;
+        }
+
+        return &feedback->second;
     }
 
-    ~ThroughputReader() {
-        m_dataRiver.close();
-        cout << "Throughput reader stopped" << endl;
+    // Sends the statistics of the search flows that changed since the last feedback, on the flow
+    // they were received on, so the writer can select the feedback of the step it is measuring
+    void sendFeedback() {
+        for (auto& flow : m_feedback) {
+            if (flow.second.changed) {
+                IOT_VALUE received_v;
+                IOT_VALUE outoforder_v;
+                IOT_VALUE latencycount_v;
+                IOT_VALUE latencyp99_v;
+                received_v.iotv_uint64(flow.second.received);
+                outoforder_v.iotv_uint64(flow.second.sequence.lost);
+                latencycount_v.iotv_uint64(flow.second.latency.count);
+                latencyp99_v.iotv_uint64(exampleGetPercentileFromTimeStats(flow.second.latency, 99.0));
+
+                IOT_NVP_SEQ feedback = {
+                    IOT_NVP("received", received_v),
+                    IOT_NVP("outoforder", outoforder_v),
+                    IOT_NVP("latencycount", latencycount_v),
+                    IOT_NVP("latencyp99", latencyp99_v)
+                };
+                m_thing.write("ThroughputFeedbackOutput", flow.first, feedback);
+                flow.second.changed = false;
+            }
+        }
+        m_lastFeedbackTime = Clock::now();
     }
 
-    int run(unsigned long pollingDelay, unsigned long runningTime) {
-        unsigned long long prevCount = 0;
-        unsigned long long prevReceived = 0;
-        unsigned long long samplesInBatch = 0;
-        unsigned long long payloadSize = 0;
-        unsigned long long deltaReceived;
-        unsigned long long deltaTime;
-        Timepoint prevTime = Timepoint();
+    // Processes one batch of samples, as returned by a read or delivered to the listener
+    void receiveSamples(const vector<DataSample<IOT_NVP_SEQ> >& samples, unsigned long long readTime) {
+        if (samples.empty()) {
+            return;
+        }
+
         IOT_UINT64 receivedSequenceNumber;
-        IOT_UINT64 lastReceivedSequenceNumber;
         bool seqNrFound = false;
-        bool firstSample = true;
 
-        cout << "Waiting for samples..." << endl;
-
-        // Loop through until the runningTime has been reached (0 = infinite)
-        // each cycle is 1 second
-        unsigned long long cycles = 0;
-
-        while (!stop && (runningTime == 0 || cycles < runningTime))
-        {
-            if (pollingDelay > 0) {
-                this_thread::sleep_for(chrono::milliseconds(pollingDelay));
-            }
+        // New batch
+        m_counters.batches++;
+        unsigned long long samplesInBatch = m_counters.samples;
+        unsigned long long bytesInBatch = m_counters.bytes;
+        ExampleTimeStats& intervalLatency = acquireLatencyStats();
+
+        // Iterate through the samples
+        for (const DataSample<IOT_NVP_SEQ>& sample : samples) {
+            if (sample.getFlowState() == FlowState::ALIVE) {
+                const IOT_NVP_SEQ& data = sample.getData();
+                FlowFeedback* feedback = getFlowFeedback(sample.getFlowId());
+
+                // find the message, stored in the name-value-pair with name 'name':
+                seqNrFound = false;
+                unsigned long long sampleRecords = 0;
+                for (const IOT_NVP& nvp : data) {
+                    if (nvp.name() == "sequencenumber") {
+                        receivedSequenceNumber = nvp.value().iotv_uint64();
+                        seqNrFound = true;
+                    } else if (nvp.name() == "sequencedata") {
+                        // Add the sample payload size to the total received
+                        const IOT_BYTE_SEQ &receivedData = nvp.value().iotv_byte_seq();
+                        m_payloadSize = receivedData.size();
+                        m_counters.bytes += m_payloadSize + 8; // add 8 bytes for sequence number field
+                        sampleRecords = addRecords(receivedData.data(), m_payloadSize, readTime, intervalLatency, feedback);
+                    }
+                }
+                if (seqNrFound) {
+                    // Increase sample count
+                    m_counters.samples++;
+                    m_counters.records += sampleRecords;
+
+                    // Each writer thread, and each step of a sweep, numbers the samples on its own
+                    // flow. A writer that is started again on the same flow restarts the numbering
+                    // at 0; a sample 0 is only a reordered sample of the current numbering while the
+                    // window still holds it and it was not received yet. Samples far behind the
+                    // window are counted late.
+                    FlowSequence& sequence = m_flowSequences[sample.getFlowId()];
+                    if (sequence.tracker.started && receivedSequenceNumber == 0
+                            && (sequence.tracker.highest >= EXAMPLE_SEQUENCE_WINDOW || exampleSequenceReceived(sequence.tracker, 0))) {
+                        exampleResetSequenceTracker(sequence.tracker);
+                    }
 
-            // New batch
-            batchCount++;
-            samplesInBatch = sampleCount;
-
-            // Take samples and iterate through them
-            vector<DataSample<IOT_NVP_SEQ> > samples = m_thing.read<IOT_NVP_SEQ>("ThroughputInput", BLOCKING_TIME_INFINITE);
-            for (const DataSample<IOT_NVP_SEQ>& sample : samples) {
-                if (sample.getFlowState() == FlowState::ALIVE) {
-                    const IOT_NVP_SEQ& data = sample.getData();
-
-                    // find the message, stored in the name-value-pair with name 'name':
-                    seqNrFound = false;
-                    for (const IOT_NVP& nvp : data) {
-                        if (nvp.name() == "sequencenumber") {
-                            receivedSequenceNumber = nvp.value().iotv_uint64();
-                            seqNrFound = true;
-                        } else if (nvp.name() == "sequencedata") {
-                            // Add the sample payload size to the total received
-                            const IOT_BYTE_SEQ &receivedData = nvp.value().iotv_byte_seq();
-                            payloadSize = receivedData.size();
-                            bytesReceived += payloadSize + 8; // add 8 bytes for sequence number field
-                        }
+                    // The statistics per payload size are kept per flow of a sweep step, by the size
+                    // that the numbering started with. A size distribution varies the size within a step.
+                    if (!sequence.tracker.started) {
+                        sequence.payloadSize = m_payloadSize;
+                    } else if (sequence.payloadSize != m_payloadSize) {
+                        payloadSizesVary = true;
                     }
-                    if (seqNrFound) {
-                        // Increase sample count
-                        sampleCount++;
 
-                        if (firstSample) {
-                            lastReceivedSequenceNumber = receivedSequenceNumber - 1;
-                            firstSample = false;
+                    // Account for the samples skipped before this one, or for this sample being
+                    // reordered, late or a duplicate
+                    ExampleSequenceCounts sampleSequence = exampleTrackSequence(sequence.tracker, receivedSequenceNumber);
+                    m_counters.sequence += sampleSequence;
+                    if (feedback) {
+                        if (sampleSequence.duplicate == 0) {
+                            feedback->received++;
                         }
+                        feedback->sequence += sampleSequence;
+                        feedback->changed = true;
+                    }
 
-                        // Check that the sample is the next one expected
-                        if (receivedSequenceNumber != lastReceivedSequenceNumber + 1) {
-                            outOfOrderCount += (receivedSequenceNumber - (lastReceivedSequenceNumber + 1 ));
+                    // Statistics per payload size, a batch counts once for each payload size in it
+                    if (m_sizeEntry == nullptr || m_sizeEntryPayloadSize != sequence.payloadSize) {
+                        addBatchToSizeStats(m_sizeEntry, m_sizeBatchSamples);
+                        m_sizeEntry = &sizeStats[sequence.payloadSize];
+                        m_sizeEntryPayloadSize = sequence.payloadSize;
+                        m_sizeBatchSamples = 0;
+                        if (m_sizeEntry->samples == 0) {
+                            m_sizeEntry->firstReadTime = readTime;
                         }
-
-                        // Keep track of last received seq nr
-                        lastReceivedSequenceNumber = receivedSequenceNumber;
                     }
-                } else {
-                    cout << "Writer flow purged, stop reader" << endl;
-                    stop = true;
+                    m_sizeEntry->samples++;
+                    m_sizeEntry->bytes += m_payloadSize + 8;
+                    m_sizeEntry->sequence += sampleSequence;
+                    m_sizeEntry->lastReadTime = readTime;
+                    m_sizeBatchSamples++;
                 }
+            } else {
+                m_flowPurged = true;
+                stop = true;
             }
+        }
+
+        addBatchToSizeStats(m_sizeEntry, m_sizeBatchSamples);
+        m_sizeBatchSamples = 0;
+
+        // Update max samples per batch
+        samplesInBatch = m_counters.samples - samplesInBatch;
+        if (samplesInBatch > m_counters.batchMaxSize) {
+            m_counters.batchMaxSize = samplesInBatch;
+        }
+        if (!timelineOutput.empty()) {
+            exampleAddToTimeline(m_timeline, readTime, samplesInBatch, m_counters.bytes - bytesInBatch);
+        }
+        releaseLatencyStats();
+
+        // Publish the counters of this batch to the reporter thread
+        m_counters.payloadSize = m_payloadSize;
+        m_publishedCounters.publish(m_counters);
+    }
+
+    // Marks the active interval latency histogram as in use by the receive thread, and returns it
+    ExampleTimeStats& acquireLatencyStats() {
+        int index;
+        do {
+            index = m_activeLatencyStats.load();
+            m_latencyStatsInUse.store(index);
+        } while (m_activeLatencyStats.load() != index);
+
+        return m_intervalLatencyStats[index];
+    }
+
+    void releaseLatencyStats() {
+        m_latencyStatsInUse.store(-1);
+    }
+
+    // Makes the other interval latency histogram active, and returns the previous one once the
+    // receive thread no longer records in it
+    ExampleTimeStats& swapLatencyStats() {
+        int previous = m_activeLatencyStats.load();
+        m_activeLatencyStats.store(1 - previous);
+        while (m_latencyStatsInUse.load() == previous) {
+            this_thread::yield();
+        }
+
+        return m_intervalLatencyStats[previous];
+    }
 
-            if (!stop) {
-                currentTime = Clock::now();
-                if (Duration<Microseconds>(currentTime - prevTime) > US_IN_ONE_SEC) {
-                    // If not the first iteration
-                    if (prevTime.time_since_epoch() != Timepoint().time_since_epoch()) {
-                        // Calculate the samples and bytes received and the time passed since the  last iteration and output
-                        deltaReceived = bytesReceived - prevReceived;
-                        deltaTime = Duration<Microseconds>(currentTime - prevTime) / US_IN_ONE_SEC;
+    // Shows the throughput of each second. Runs on the reporter thread, so the receive thread
+    // never waits for the formatting and the console output.
+    void report() {
+        exampleSetThreadName("reporter");
+        ReaderCounters prevCounters = ReaderCounters();
+        Timepoint prevTime = Timepoint();
+        unsigned long long prevCpuTime = 0;
+        unsigned long long deltaReceived;
+        unsigned long long deltaTime;
+        double cpuPercentage;
 
+        while (!stop) {
+            this_thread::sleep_for(chrono::milliseconds(REPORT_POLL_INTERVAL));
+            ReaderCounters counters = m_publishedCounters.read();
+            if (counters.batches == 0) {
+                continue;
+            }
+
+            currentTime = Clock::now();
+            if (Duration<Microseconds>(currentTime - prevTime) > US_IN_ONE_SEC) {
+                unsigned long long cpuTime = exampleProcessCpuNanoseconds();
+                ExampleTimeStats& intervalLatency = swapLatencyStats();
+
+                // If not the first iteration
+                if (prevTime.time_since_epoch() != Timepoint().time_since_epoch()) {
+                    // Calculate the samples and bytes received and the time passed since the  last iteration and output
+                    deltaReceived = counters.bytes - prevCounters.bytes;
+                    deltaTime = Duration<Microseconds>(currentTime - prevTime) / US_IN_ONE_SEC;
+                    cpuPercentage = (double)(cpuTime - prevCpuTime) * 100 / (Duration<Microseconds>(currentTime - prevTime) * NS_IN_ONE_US);
+
+                    if (outputFormat != text) {
+                        writeRecord(counters, "interval", (double)Duration<Microseconds>(currentTime - startTime) / US_IN_ONE_SEC,
+                                (double)(counters.samples - prevCounters.samples) / deltaTime,
+                                (double)(counters.records - prevCounters.records) / deltaTime,
+                                ((double)deltaReceived / BYTES_PER_SEC_TO_MEGABITS_PER_SEC) / deltaTime, intervalLatency, cpuPercentage);
+                    } else {
                         cout << fixed
-                                    << "Payload size: " << payloadSize << " | "
-                                    << "Total: " << setw(9) << right << sampleCount << " samples, "
-                                    << setw(12) << right << bytesReceived << " bytes | "
-                                    << setw(6) << right << "Out of order: " << outOfOrderCount << " samples | "
-                                    << "Transfer rate: " << setw(7) << right << setprecision(0) << (double)(sampleCount - prevCount) / deltaTime << " samples/s, "
-                                        << setw(9) << right << setprecision(2) << ((double)deltaReceived / BYTES_PER_SEC_TO_MEGABITS_PER_SEC) / deltaTime << " Mbit/s"
-                                    << endl;
-
-                        cycles++;
-                    }
-                    else
-                    {
-                        // Set the start time if it is the first iteration
-                        startTime = currentTime;
+                                    << "Payload size: " << counters.payloadSize << " | "
+                                    << "Total: " << setw(9) << right << counters.samples << " samples, "
+                                    << setw(12) << right << counters.bytes << " bytes | "
+                                    << "Lost: " << setw(6) << right << counters.sequence.lost << " samples | "
+                                    << "Transfer rate: " << setw(7) << right << setprecision(0) << (double)(counters.samples - prevCounters.samples) / deltaTime << " samples/s, "
+                                        << setw(9) << right << setprecision(2) << ((double)deltaReceived / BYTES_PER_SEC_TO_MEGABITS_PER_SEC) / deltaTime << " Mbit/s";
+                        if (counters.records != counters.samples) {
+                            cout << " | Records: " << setw(9) << right << setprecision(0)
+                                    << (double)(counters.records - prevCounters.records) / deltaTime << " records/s";
+                        }
+                        if (counters.sequence.reordered + counters.sequence.late + counters.sequence.duplicate > 0) {
+                            cout << " | Reordered: " << counters.sequence.reordered << ", late: " << counters.sequence.late
+                                    << ", duplicate: " << counters.sequence.duplicate;
+                        }
+                        if (intervalLatency.count > 0) {
+                            cout << " | Latency: " << getLatencyPercentiles(intervalLatency);
+                        }
+                        cout << " | CPU: " << setprecision(1) << cpuPercentage << "%" << endl;
                     }
 
-                    // Update the previous values for next iteration
-                    prevReceived = bytesReceived;
-                    prevCount = sampleCount;
-                    prevTime = currentTime;
+                    m_cycles++;
                 }
+                else
+                {
+                    // Set the start time if it is the first iteration
+                    startTime = currentTime;
+                    startCpuTime = cpuTime;
+                }
+
+                // Update the previous values for next iteration
+                latencyStats += intervalLatency;
+                exampleResetTimeStats(intervalLatency);
+                prevCounters = counters;
+                prevTime = currentTime;
+                prevCpuTime = cpuTime;
+            }
+        }
+    }
+
+public:
+    ThroughputReader(string thingPropertiesUri) :
+            m_thingPropertiesUri(thingPropertiesUri), m_sampleListener(*this),
+            m_activeLatencyStats(0), m_latencyStatsInUse(-1), m_cycles(0), m_flowPurged(false) {
+        if (!timelineOutput.empty()) {
+            m_timeline = exampleInitTimeline(timelineBucket * NS_IN_ONE_MS, timelineLength * 1000 / timelineBucket);
+        }
+        messageStream() << "Throughput reader started" << endl;
+    }
+
+    ~ThroughputReader() {
+        m_dataRiver.close();
+        messageStream() << "Throughput reader stopped" << endl;
+    }
+
+    int run(unsigned long pollingDelay, unsigned long runningTime, const string& flowSelection) {
+        messageStream() << "Reader mode: " << getReaderModeName(readerMode);
+        if (readerMode == ReaderMode::selector) {
+            messageStream() << " (flow " << flowSelection << ")";
+        }
+        messageStream() << endl << "Waiting for samples..." << endl;
+        writeRecordHeader();
+
+        Thing::Selector selector = m_thing.select("ThroughputInput").flow(flowSelection);
+        if (readerMode == ReaderMode::listener) {
+            m_thing.addListener(m_sampleListener, m_dispatcher);
+        }
 
-                // Update max samples per batch
-                samplesInBatch = sampleCount - samplesInBatch;
-                if (samplesInBatch > batchMaxSize) {
-                    batchMaxSize = samplesInBatch;
+        unsigned long long runStartTime = exampleNowNanoseconds();
+        unsigned long long runStartCpuTime = exampleProcessCpuNanoseconds();
+        vector<ExampleThreadCpu> startThreadCpu;
+        if (scheduling.threadCpu) {
+            startThreadCpu = exampleGetThreadCpuTimes();
+        }
+
+        // This thread receives the samples, the reporter thread shows the progress
+        thread reporter(&ThroughputReader::report, this);
+
+        // Loop through until the runningTime has been reached (0 = infinite)
+        // each cycle is 1 second
+        while (!stop && (runningTime == 0 || m_cycles < runningTime))
+        {
+            if (pollingDelay > 0) {
+                this_thread::sleep_for(chrono::milliseconds(pollingDelay));
+            }
+
+            // Take samples, with a timeout so that the feedback of a search step is sent
+            // after the writer stopped writing
+            if (readerMode == ReaderMode::listener) {
+                try {
+                    // The listener processes the samples on this thread
+                    m_dispatcher.processEvents(FEEDBACK_INTERVAL);
+                } catch (TimeoutError e) {
+                    // Ignore.
                 }
+            } else {
+                vector<DataSample<IOT_NVP_SEQ> > samples = (readerMode == ReaderMode::readNext) ?
+                    m_thing.read_next<IOT_NVP_SEQ>("ThroughputInput", FEEDBACK_INTERVAL) :
+                    ((readerMode == ReaderMode::selector) ? selector.read<IOT_NVP_SEQ>(FEEDBACK_INTERVAL) : m_thing.read<IOT_NVP_SEQ>("ThroughputInput", FEEDBACK_INTERVAL));
+                receiveSamples(samples, exampleNowNanoseconds());
             }
+
+            if (!m_feedback.empty() && Duration<Milliseconds>(Clock::now() - m_lastFeedbackTime) >= FEEDBACK_INTERVAL) {
+                sendFeedback();
+            }
+        }
+
+        if (readerMode == ReaderMode::listener) {
+            m_thing.removeListener(m_sampleListener, m_dispatcher);
+        }
+
+        // The CPU time per thread is taken while the reporter thread still runs
+        vector<ExampleThreadCpu> endThreadCpu;
+        if (scheduling.threadCpu) {
+            endThreadCpu = exampleGetThreadCpuTimes();
+        }
+        unsigned long long runTime = exampleNowNanoseconds() - runStartTime;
+        unsigned long long runCpuTime = exampleProcessCpuNanoseconds() - runStartCpuTime;
+
+        stop = true;
+        reporter.join();
+        if (m_flowPurged) {
+            messageStream() << "Writer flow purged, stop reader" << endl;
         }
 
-        showSummary();
+        // Add the latency of the last interval, now that no thread records it anymore
+        currentTime = Clock::now();
+        latencyStats += m_intervalLatencyStats[0];
+        latencyStats += m_intervalLatencyStats[1];
+        showSummary(m_counters);
+        if (scheduling.threadCpu) {
+            exampleShowThreadCpuTimes(messageStream(), startThreadCpu, endThreadCpu, runTime, runCpuTime,
+                m_counters.samples, "samples");
+        }
+
+        if (!timelineOutput.empty()) {
+            ofstream out(timelineOutput);
+            if (!out) {
+                cerr << "ERROR: Cannot write " << timelineOutput << endl;
+            } else {
+                exampleWriteTimeline(m_timeline, out);
+                messageStream() << "Throughput timeline written to " << timelineOutput << endl;
+            }
+        }
 
         return 0;
     }
@@ -241,13 +820,37 @@ public:
 
 static void GetCommandLineParameters(int argc, char *argv[],
         unsigned long& pollingDelay,
-        unsigned long& runningTime
+        unsigned long& runningTime,
+        bool& sweepJson,
+        string& sweepOutput,
+        string& timelineOutput,
+        unsigned long& timelineBucket,
+        unsigned long& timelineLength,
+        OutputFormat& outputFormat,
+        string& writerModeLabel,
+        ReaderMode& readerMode,
+        string& flowSelection,
+        ExampleSchedulingSettings& scheduling
 ) {
     cxxopts::Options options("ThroughputReader", "ADLINK ThingSDK ThroughputReader");
     try {
         options.add_options()
             ("p,polling-delay", "Polling delay (milliseconds)", cxxopts::value<unsigned long>()->default_value("0"))
+            ("reader-mode", "Reader mode (read, read_next, selector, listener)", cxxopts::value<string>()->default_value("read"))
+            ("flow", "Flow id selection of the selector reader mode", cxxopts::value<string>()->default_value("*"))
             ("r,running-time", "Running time (seconds, 0 = infinite)", cxxopts::value<unsigned long>()->default_value("0"))
+            ("sweep-format", "Format of the statistics per payload size of a sweep (csv, json)", cxxopts::value<string>()->default_value("csv"))
+            ("sweep-output", "File to write the statistics per payload size to (default stdout, when more than one payload size is received)", cxxopts::value<string>()->default_value(""))
+            ("timeline", "File to write the throughput of short intervals to at exit, as csv (analyze it with throughputtimeline)", cxxopts::value<string>()->default_value(""))
+            ("timeline-bucket", "Length of the timeline intervals in milliseconds", cxxopts::value<unsigned long>()->default_value("10"))
+            ("timeline-length", "Seconds at the end of the run that the timeline covers", cxxopts::value<unsigned long>()->default_value("600"))
+            ("format", "Output format (text, jsonl, csv)", cxxopts::value<string>()->default_value("text"))
+            ("writer-mode", "Writer mode of the throughput writer, recorded in the jsonl and csv output", cxxopts::value<string>()->default_value("standard"))
+            ("cpus", "CPUs to run on, for example 0-3,8", cxxopts::value<string>()->default_value(""))
+            ("numa-nodes", "NUMA nodes to allocate memory from, for example 0 (Linux)", cxxopts::value<string>()->default_value(""))
+            ("fifo-priority", "Run with the SCHED_FIFO scheduling policy at this priority (0 keeps the default policy, Linux)", cxxopts::value<int>()->default_value("0"))
+            ("lock-memory", "Lock all current and future memory with mlockall (Linux)", cxxopts::value<bool>())
+            ("thread-cpu", "Show the CPU time of each thread at the end of the run", cxxopts::value<bool>())
             ("h,help", "Print help")
             ;
         options.parse_positional({"polling-delay", "running-time", "other"});
@@ -262,6 +865,64 @@ static void GetCommandLineParameters(int argc, char *argv[],
 
         pollingDelay = cmdLineOptions["p"].as<unsigned long>();
         runningTime = cmdLineOptions["r"].as<unsigned long>();
+        sweepOutput = cmdLineOptions["sweep-output"].as<string>();
+        timelineOutput = cmdLineOptions["timeline"].as<string>();
+        timelineBucket = cmdLineOptions["timeline-bucket"].as<unsigned long>();
+        timelineLength = cmdLineOptions["timeline-length"].as<unsigned long>();
+        if (timelineBucket == 0 || timelineLength * 1000 < timelineBucket) {
+            cerr << "Invalid timeline settings" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+        writerModeLabel = cmdLineOptions["writer-mode"].as<string>();
+        flowSelection = cmdLineOptions["flow"].as<string>();
+
+        if (cmdLineOptions["reader-mode"].as<string>() == "read") {
+            readerMode = ReaderMode::readAll;
+        } else if (cmdLineOptions["reader-mode"].as<string>() == "read_next") {
+            readerMode = ReaderMode::readNext;
+        } else if (cmdLineOptions["reader-mode"].as<string>() == "selector") {
+            readerMode = ReaderMode::selector;
+        } else if (cmdLineOptions["reader-mode"].as<string>() == "listener") {
+            readerMode = ReaderMode::listener;
+        } else {
+            cerr << "Invalid reader-mode" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+
+        if (cmdLineOptions["sweep-format"].as<string>() == "csv") {
+            sweepJson = false;
+        } else if (cmdLineOptions["sweep-format"].as<string>() == "json") {
+            sweepJson = true;
+        } else {
+            cerr << "Invalid sweep format" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+
+        if (cmdLineOptions["format"].as<string>() == "text") {
+            outputFormat = text;
+        } else if (cmdLineOptions["format"].as<string>() == "jsonl") {
+            outputFormat = jsonl;
+        } else if (cmdLineOptions["format"].as<string>() == "csv") {
+            outputFormat = csv;
+        } else {
+            cerr << "Invalid output format" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+
+        if (!exampleParseCpuList(cmdLineOptions["cpus"].as<string>(), scheduling.cpus)
+                || !exampleParseCpuList(cmdLineOptions["numa-nodes"].as<string>(), scheduling.numaNodes)
+                || cmdLineOptions["fifo-priority"].as<int>() < 0) {
+            cerr << "Invalid CPU placement or scheduling settings" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+        scheduling.fifoPriority = cmdLineOptions["fifo-priority"].as<int>();
+        scheduling.lockMemory = cmdLineOptions["lock-memory"].as<bool>();
+        scheduling.threadCpu = cmdLineOptions["thread-cpu"].as<bool>();
     }
     catch (cxxopts::OptionException e) {
         cerr << e.what() << endl << endl;
@@ -279,7 +940,15 @@ int main(int argc, char *argv[]) {
     // Get command line parameters
     unsigned long pollingDelay;
     unsigned long runningTime;
-    GetCommandLineParameters(argc, argv, pollingDelay, runningTime);
+    string flowSelection;
+    GetCommandLineParameters(argc, argv, pollingDelay, runningTime, sweepJson, sweepOutput, timelineOutput, timelineBucket, timelineLength, outputFormat, writerModeLabel, readerMode, flowSelection, scheduling);
+    hostName = exampleHostName();
+    buildInfo = exampleBuildInfo();
+
+    // Place and schedule the process before the Thing starts its threads, so they inherit it
+    if (!exampleApplySchedulingSettings(scheduling)) {
+        return 1;
+    }
 
     // Register handler for Ctrl-C
     registerControlHandler();
@@ -287,7 +956,7 @@ int main(int argc, char *argv[]) {
     try
     {
         return ThroughputReader("file://./config/ThroughputReaderProperties.json")
-            .run(pollingDelay, runningTime);
+            .run(pollingDelay, runningTime, flowSelection);
     }
     catch (ThingAPIException e)
     {
@@ -0,0 +1,237 @@
+/*                         ADLINK Edge SDK
+ *
+ *   This software and documentation are Copyright 2018 to 2020 ADLINK
+ *   Technology Limited, its affiliated companies and licensors. All rights
+ *   reserved.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ *
+ */
+
+/**
+ * This application analyzes the throughput timeline that the throughput reader writes with
+ * --timeline: it lists the longest stalls and the periods in which the throughput dropped below
+ * a percentage of the mean throughput
+ *
+ */
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "include/cxxopts.hpp"
+
+using namespace std;
+
+// One interval of the timeline
+typedef struct TimelineBucket {
+    double time;
+    unsigned long long samples;
+    unsigned long long bytes;
+    double maxGap;
+} TimelineBucket;
+
+// A period in which the throughput was below the threshold
+typedef struct ThroughputDrop {
+    double time;
+    double duration;
+    double lowest;
+} ThroughputDrop;
+
+static bool readTimeline(const string& fileName, vector<TimelineBucket>& buckets) {
+    ifstream in(fileName);
+    if (!in) {
+        return false;
+    }
+
+    string line;
+    getline(in, line); // header
+    while (getline(in, line)) {
+        TimelineBucket bucket;
+        char separator;
+        istringstream fields(line);
+        if (fields >> bucket.time >> separator >> bucket.samples >> separator >> bucket.bytes >> separator >> bucket.maxGap) {
+            buckets.push_back(bucket);
+        }
+    }
+
+    return true;
+}
+
+static void showStalls(const vector<TimelineBucket>& buckets, unsigned long top) {
+    vector<size_t> order(buckets.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) {
+        return buckets[a].maxGap > buckets[b].maxGap;
+    });
+
+    // A gap is recorded in the interval of the read that ended it
+    cout << endl << "Longest stalls (time without reads):" << endl;
+    for (size_t i = 0; i < order.size() && i < top && buckets[order[i]].maxGap > 0; i++) {
+        const TimelineBucket& bucket = buckets[order[i]];
+        cout << "  " << setw(10) << right << setprecision(1) << bucket.maxGap / 1000 << " ms, ended in the interval at "
+            << setprecision(0) << bucket.time << " ms" << endl;
+    }
+}
+
+static void showDrops(const vector<TimelineBucket>& buckets, double bucketTime, double meanSamples, unsigned long window,
+        double threshold, unsigned long top) {
+    vector<ThroughputDrop> drops;
+    double windowMean = meanSamples * window;
+    unsigned long long windowSamples = 0;
+    bool inDrop = false;
+
+    // Slide a window of 'window' intervals over the timeline
+    for (size_t i = 0; i < buckets.size(); i++) {
+        windowSamples += buckets[i].samples;
+        if (i >= window) {
+            windowSamples -= buckets[i - window].samples;
+        }
+        if (i + 1 < window) {
+            continue;
+        }
+
+        double percentage = 100.0 * windowSamples / windowMean;
+        if (percentage < threshold) {
+            if (!inDrop) {
+                ThroughputDrop drop;
+                drop.time = buckets[i + 1 - window].time;
+                drop.lowest = percentage;
+                drops.push_back(drop);
+                inDrop = true;
+            }
+            drops.back().duration = buckets[i].time + bucketTime - drops.back().time;
+            drops.back().lowest = min(drops.back().lowest, percentage);
+        } else {
+            inDrop = false;
+        }
+    }
+
+    double totalDuration = 0;
+    for (const ThroughputDrop& drop : drops) {
+        totalDuration += drop.duration;
+    }
+    cout << endl << "Throughput below " << setprecision(0) << threshold << "% of the mean over "
+        << window * bucketTime << " ms: " << drops.size() << " times, " << totalDuration << " ms in total" << endl;
+
+    // The longest drops, in order of time
+    if (drops.size() > top) {
+        vector<ThroughputDrop> longest = drops;
+        nth_element(longest.begin(), longest.begin() + top - 1, longest.end(), [](const ThroughputDrop& a, const ThroughputDrop& b) {
+            return a.duration > b.duration;
+        });
+        double minDuration = longest[top - 1].duration;
+        drops.erase(remove_if(drops.begin(), drops.end(), [minDuration](const ThroughputDrop& drop) {
+            return drop.duration < minDuration;
+        }), drops.end());
+        drops.resize(min(drops.size(), (size_t)top));
+    }
+    for (const ThroughputDrop& drop : drops) {
+        cout << "  at " << setw(10) << right << setprecision(0) << drop.time << " ms for "
+            << setw(7) << right << drop.duration << " ms, lowest " << setprecision(1) << drop.lowest << "% of the mean" << endl;
+    }
+}
+
+static void GetCommandLineParameters(int argc, char *argv[],
+        string& input,
+        unsigned long& top,
+        double& threshold,
+        unsigned long& windowTime
+) {
+    cxxopts::Options options("ThroughputTimeline", "ADLINK ThingSDK ThroughputTimeline");
+    try {
+        options.add_options()
+            ("i,input", "Timeline written by the throughput reader with --timeline", cxxopts::value<string>()->default_value(""))
+            ("top", "Number of stalls and throughput drops to list", cxxopts::value<unsigned long>()->default_value("10"))
+            ("threshold", "List the periods in which the throughput is below this percentage of the mean", cxxopts::value<double>()->default_value("50"))
+            ("window", "Time in milliseconds over which the throughput is compared with the mean (0 is one interval)", cxxopts::value<unsigned long>()->default_value("0"))
+            ("h,help", "Print help")
+            ;
+        options.parse_positional({"input", "other"});
+        options.positional_help("[input]");
+
+        auto cmdLineOptions = options.parse(argc, argv);
+
+        if (cmdLineOptions.count("help")) {
+            cout << options.help({""}) << endl;
+            exit(0);
+        }
+
+        input = cmdLineOptions["i"].as<string>();
+        top = cmdLineOptions["top"].as<unsigned long>();
+        threshold = cmdLineOptions["threshold"].as<double>();
+        windowTime = cmdLineOptions["window"].as<unsigned long>();
+
+        if (input.empty() || top == 0 || threshold <= 0) {
+            cerr << "Invalid parameters" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+    }
+    catch (cxxopts::OptionException e) {
+        cerr << e.what() << endl << endl;
+        cout << options.help({""}) << endl;
+        exit(1);
+    }catch (const std::domain_error e1) {
+        cerr << e1.what() << endl << endl;
+        cout << options.help({""}) << endl;
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    // Get command line parameters
+    string input;
+    unsigned long top;
+    double threshold;
+    unsigned long windowTime;
+    GetCommandLineParameters(argc, argv, input, top, threshold, windowTime);
+
+    vector<TimelineBucket> buckets;
+    if (!readTimeline(input, buckets)) {
+        cerr << "ERROR: Cannot read " << input << endl;
+        return 1;
+    }
+    if (buckets.size() < 2) {
+        cerr << "ERROR: The timeline has less than two intervals" << endl;
+        return 1;
+    }
+
+    double bucketTime = buckets[1].time - buckets[0].time;
+    double duration = buckets.back().time + bucketTime - buckets.front().time;
+    unsigned long long samples = 0;
+    unsigned long long bytes = 0;
+    for (const TimelineBucket& bucket : buckets) {
+        samples += bucket.samples;
+        bytes += bucket.bytes;
+    }
+    double meanSamples = (double)samples / buckets.size();
+    unsigned long window = max(1UL, (unsigned long)(windowTime / bucketTime + 0.5));
+
+    cout << fixed
+        << "Timeline: " << buckets.size() << " intervals of " << setprecision(0) << bucketTime << " ms, "
+        << duration << " ms" << endl
+        << "Mean throughput: " << samples * 1000 / duration << " samples/s, "
+        << setprecision(2) << (double)bytes * 8 / 1000 / duration << " Mbit/s" << endl;
+
+    showStalls(buckets, top);
+    showDrops(buckets, bucketTime, meanSamples, min(window, (unsigned long)buckets.size()), threshold, top);
+
+    return 0;
+}
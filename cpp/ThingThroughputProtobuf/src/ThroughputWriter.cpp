@@ -21,15 +21,19 @@
 /**
  * This is a simple throughput application measuring obtainable throughput using the thingSDK
  */
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <signal.h>
 #include <sstream>
 #include <stdlib.h>
 #include <thread>
 #include <time.h>
+#include <vector>
 #ifdef _WIN32
 #include <Windows.h>
 #endif
@@ -41,6 +45,7 @@
 #include "include/utilities.h"
 
 #include "definitions/ThroughputTagGroup.dr.h"
+#include "definitions/ThroughputFeedbackTagGroup.dr.h"
 
 using namespace std;
 using namespace com::adlinktech::datariver;
@@ -71,12 +76,68 @@ enum WriterMode {
     outputHandlerNotThreadSafe
 };
 
+// Number of samples written by one writer thread, padded to a cache line so the threads do
+// not slow each other down by updating their counters
+typedef struct WriterThreadCount {
+    atomic<unsigned long long> count;
+    char padding[64 - sizeof(atomic<unsigned long long>)];
+} WriterThreadCount;
+
+// After a search step the writer waits for the feedback of the reader until all samples are
+// reported, or until the reported count has not changed for SEARCH_SETTLE_TIME ms
+#define SEARCH_SETTLE_TIME 1000
+#define SEARCH_FEEDBACK_TIMEOUT 100
+// A search step fails if the writer cannot keep up with this fraction of the offered rate
+#define SEARCH_MIN_WRITTEN_RATE 0.95
+
+// Pause in ms between the payload sizes of a sweep, to let the reader receive the samples
+// of the previous payload size
+#define SWEEP_PAUSE 1000
+
+// Settings of the search for the maximum sustainable throughput
+typedef struct SearchSettings {
+    bool enabled;
+    unsigned long long minRate;
+    unsigned long long maxRate;
+    unsigned long stepTime;
+    double precision;
+    double maxLoss;
+    double maxLatencyP99;
+} SearchSettings;
+
+// Application-level batching: the records are packed into the payload of one sample, which is
+// written once it holds 'records' records or its first record waited 'deadline' ns
+typedef struct BatchSettings {
+    unsigned long records;
+    unsigned long long deadline;
+} BatchSettings;
+
+// Result of writing at one rate during the search, as reported by the reader
+typedef struct SearchStep {
+    unsigned long long offeredRate;
+    double writtenRate;
+    unsigned long long written;
+    unsigned long long received;
+    unsigned long long latencyCount;
+    unsigned long long latencyP99;
+    double loss;
+    bool passed;
+} SearchStep;
+
 class ThroughputWriter {
 private:
     string m_thingPropertiesUri;
     DataRiver m_dataRiver = createDataRiver();
     ThingEx m_thing = createThing();
-    Throughput m_sample;
+    // Ring of pregenerated samples that the writer threads cycle through
+    vector<Throughput> m_samples;
+    double m_meanPayloadSize = 0;
+    ExamplePayloadSettings m_payloadSettings;
+    bool m_latency = false;
+    BatchSettings m_batch = { 1, 0 };
+    bool m_threadCpu = false;
+    // Rate in samples/s of each writer thread, 0 writes in bursts
+    double m_rate = 0;
 
     DataRiver createDataRiver() {
         return DataRiver::getInstance();
@@ -85,6 +146,7 @@ private:
     ThingEx createThing() {
         // Create and Populate the TagGroup registry with JSON resource files.
         ThroughputHelper::registerWithDataRiver(m_dataRiver);
+        ThroughputFeedbackHelper::registerWithDataRiver(m_dataRiver);
 
         // Create and Populate the ThingClass registry with JSON resource files.
         JSonThingClassRegistry tcr;
@@ -98,9 +160,31 @@ private:
         return m_dataRiver.createThing(tp);
     }
 
+    // Size of a sample as counted by the reader
+    double getSampleSize(double payloadSize) {
+        return payloadSize;
+    }
+
+    // Pregenerates the ring of samples, so that generating the payloads stays out of the write loop
     void setupMessage(unsigned long payloadSize) {
-        m_sample.set_sequencenumber(0);
-        m_sample.set_sequencedata(string(payloadSize, 'a'));
+        mt19937_64 generator(EXAMPLE_PAYLOAD_SEED);
+        vector<unsigned long> sizes = exampleGeneratePayloadSizes(payloadSize,
+            m_latency ? EXAMPLE_PAYLOAD_TIMESTAMP_SIZE : 0, m_payloadSettings, generator);
+        size_t corpusOffset = 0;
+        unsigned long long totalSize = 0;
+
+        m_samples.clear();
+        for (unsigned long size : sizes) {
+            string sequencedata(size, '\0');
+            exampleFillPayload((unsigned char*)&sequencedata[0], size, m_payloadSettings, generator, corpusOffset);
+
+            Throughput sample;
+            sample.set_sequencenumber(0);
+            sample.set_sequencedata(sequencedata);
+            m_samples.push_back(sample);
+            totalSize += size;
+        }
+        m_meanPayloadSize = (double)totalSize / sizes.size();
     }
 
     void waitForReader() {
@@ -131,23 +215,131 @@ private:
         }
     }
 
-    void write(unsigned long burstInterval, unsigned long burstSize, unsigned long runningTime, WriterMode mode) {
+    // Writes the samples of one writer thread on its own flow. The standard mode shares the Thing
+    // between the threads, the output handler modes use an output handler per thread.
+    void write(string flowId, unsigned long burstInterval, unsigned long burstSize, unsigned long runningTime, WriterMode mode,
+            atomic<unsigned long long>& writtenCount) {
         unsigned long burstCount = 0;
         unsigned long count = 0;
         bool timedOut = false;
         unsigned long long deltaTime;
+        // Each thread cycles through its own copy of the ring of samples
+        vector<Throughput> samples = m_samples;
+        size_t sampleIndex = 0;
+        Throughput* sample = &samples[0];
+        unsigned char* payload = (unsigned char*)&(*sample->mutable_sequencedata())[0];
 
         Timepoint pubStart = Clock::now();
         Timepoint burstStart = Clock::now();
         Timepoint currentTime = Clock::now();
 
+        auto outputHandler = m_thing.getOutputHandler("ThroughputOutput");
+
+        // With a fixed rate the burst size is the size of the token bucket
+        ExampleRateLimiter rateLimiter = exampleInitRateLimiter(m_rate, burstSize);
+
+        // The non-reentrant write binds the flow and the message to the output handler once;
+        // each write then only serializes the preallocated message
+        if (mode == WriterMode::outputHandlerNotThreadSafe) {
+            outputHandler.setNonReentrantFlowID(flowId.empty() ? m_thing.getContextId() : flowId);
+            outputHandler.setupNonReentrant(*sample);
+        }
+
+        // Writes a message with the writer mode of the thread, numbered with the next sequence number
+        auto writeMessage = [&](Throughput& message) {
+            message.set_sequencenumber(count++);
+
+            if (mode == WriterMode::outputHandler) {
+                // Write the data using output handler
+                if (flowId.empty()) {
+                    outputHandler.write(message);
+                } else {
+                    outputHandler.write(flowId, message);
+                }
+            } else if (mode == WriterMode::outputHandlerNotThreadSafe) {
+                // Write the data using non-reentrant write on output handler
+                outputHandler.writeNonReentrant(message);
+            } else {
+                // Write the data
+                if (flowId.empty()) {
+                    m_thing.write("ThroughputOutput", message);
+                } else {
+                    m_thing.write("ThroughputOutput", flowId, message);
+                }
+            }
+        };
+
+        // With batching, the records are added to the payload of a separate message, whose
+        // buffer is reserved for a full batch of the largest records
+        Throughput batchMessage = samples[0];
+        string* batchData = batchMessage.mutable_sequencedata();
+        unsigned long batchRecords = 0;
+        unsigned long long batchStart = 0;
+        unsigned long long recordCount = 0;
+        if (m_batch.records > 1) {
+            size_t maxRecordSize = 0;
+            for (const Throughput& ringSample : samples) {
+                maxRecordSize = max(maxRecordSize, ringSample.sequencedata().size());
+            }
+            batchData->reserve(EXAMPLE_BATCH_HEADER_SIZE + m_batch.records * (sizeof(ExampleBatchRecordSize) + maxRecordSize));
+            exampleStartBatch(*batchData);
+        }
+
+        auto writeBatch = [&]() {
+            exampleFinishBatch(*batchData, batchRecords);
+            writeMessage(batchMessage);
+            exampleStartBatch(*batchData);
+            batchRecords = 0;
+        };
+
         while (!stop && !timedOut)
         {
             // Write data until burst size has been reached
             if (burstCount++ < burstSize) {
-                m_sample.set_sequencenumber(count++);
-                m_thing.write("ThroughputOutput", m_sample);
+                // At a fixed rate, wait until the next sample is due. A pending batch is written
+                // at its deadline when that passes first.
+                if (m_rate > 0) {
+                    if (batchRecords > 0 && exampleGetRateLimiterDue(rateLimiter) >= batchStart + m_batch.deadline) {
+                        exampleWaitUntil(batchStart + m_batch.deadline);
+                        writeBatch();
+                    }
+                    exampleAcquireRateLimiter(rateLimiter);
+                }
+
+                // Take the next sample of the ring
+                if (samples.size() > 1) {
+                    sample = &samples[sampleIndex];
+                    payload = (unsigned char*)&(*sample->mutable_sequencedata())[0];
+                    sampleIndex = (sampleIndex + 1 < samples.size()) ? sampleIndex + 1 : 0;
+                }
+
+                // Stamp the send time into the payload
+                if (m_latency) {
+                    exampleWritePayloadTimestamp(payload, exampleNowNanoseconds());
+                }
+
+                if (m_batch.records > 1) {
+                    // Add the record to the batch, and write the batch once it is full or its
+                    // first record waited for the batch deadline
+                    unsigned long long now = exampleNowNanoseconds();
+                    if (batchRecords == 0) {
+                        batchStart = now;
+                    }
+                    exampleAddBatchRecord(*batchData, payload, sample->sequencedata().size());
+                    if (++batchRecords >= m_batch.records || now - batchStart >= m_batch.deadline) {
+                        writeBatch();
+                    }
+                    writtenCount.store(++recordCount, memory_order_relaxed);
+                } else {
+                    writeMessage(*sample);
+                    writtenCount.store(count, memory_order_relaxed);
+                }
             } else if (burstInterval != 0) {
+                // Write the pending batch before sleeping
+                if (batchRecords > 0) {
+                    writeBatch();
+                }
+
                 // Sleep until burst interval has passed
                 currentTime = Clock::now();
 
@@ -171,14 +363,255 @@ private:
             }
         }
 
+        if (batchRecords > 0) {
+            writeBatch();
+        }
+    }
+
+    // Runs the writer threads and reports the write rate of each thread every second
+    // The threads write on the flows that start with flowPrefix, or on the default flow and the
+    // context flows when the prefix is empty
+    void writeThreads(const string& flowPrefix, unsigned long threadCount, unsigned long burstInterval, unsigned long burstSize,
+            unsigned long runningTime, WriterMode mode) {
+        vector<WriterThreadCount> counts(threadCount);
+        vector<unsigned long long> prevCounts(threadCount, 0);
+        vector<thread> threads;
+        atomic<unsigned long> runningThreads(threadCount);
+        // With batching the threads count the records they write
+        string unit = (m_batch.records > 1) ? "records" : "samples";
+
+        for (unsigned long i = 0; i < threadCount; i++) {
+            counts[i].count = 0;
+        }
+
+        // The writer threads report their own CPU time, they have exited when it is shown
+        vector<ExampleThreadCpu> startThreadCpu;
+        vector<ExampleThreadCpu> writerThreadCpu(threadCount);
+        unsigned long long startCpuTime = exampleProcessCpuNanoseconds();
+        if (m_threadCpu) {
+            startThreadCpu = exampleGetThreadCpuTimes();
+        }
+
+        // A single thread writes on the default flow, like a writer without threads
+        Timepoint startTime = Clock::now();
+        for (unsigned long i = 0; i < threadCount; i++) {
+            string flowId = flowPrefix;
+            if (threadCount > 1) {
+                flowId = (flowPrefix.empty() ? m_thing.getContextId() : flowPrefix) + "." + to_string(i);
+            }
+            threads.push_back(thread([this, flowId, burstInterval, burstSize, runningTime, mode, &counts, &runningThreads, &writerThreadCpu, i] {
+                string name = "writer-" + to_string(i);
+                exampleSetThreadName(name);
+                write(flowId, burstInterval, burstSize, runningTime, mode, counts[i].count);
+                writerThreadCpu[i] = exampleGetCurrentThreadCpu(name);
+                runningThreads--;
+            }));
+        }
+
+        Timepoint prevTime = startTime;
+        while (runningThreads > 0) {
+            this_thread::sleep_for(chrono::milliseconds(100));
+
+            Timepoint currentTime = Clock::now();
+            unsigned long long deltaTime = Duration<Microseconds>(currentTime - prevTime);
+            if (deltaTime >= US_IN_ONE_SEC || runningThreads == 0) {
+                unsigned long long total = 0;
+                unsigned long long deltaTotal = 0;
+                ostringstream threadRates;
+                for (unsigned long i = 0; i < threadCount; i++) {
+                    unsigned long long count = counts[i].count.load(memory_order_relaxed);
+                    threadRates << " " << setprecision(0) << fixed << (double)(count - prevCounts[i]) * US_IN_ONE_SEC / deltaTime;
+                    total += count;
+                    deltaTotal += count - prevCounts[i];
+                    prevCounts[i] = count;
+                }
+                cout << "Written: " << setw(10) << right << total << " " << unit << " | Write rate: " << setw(9) << right << fixed << setprecision(0)
+                    << (double)deltaTotal * US_IN_ONE_SEC / deltaTime << " " << unit << "/s";
+                if (m_rate > 0) {
+                    cout << " (requested " << m_rate * threadCount << ")";
+                }
+                if (threadCount > 1) {
+                    cout << " | per thread:" << threadRates.str();
+                }
+                cout << endl;
+                prevTime = currentTime;
+            }
+        }
+
+        for (thread& t : threads) {
+            t.join();
+        }
+
         // Show stats
+        double elapsedTime = (double)Duration<Microseconds>(Clock::now() - startTime) / US_IN_ONE_SEC;
+        unsigned long long total = 0;
+        for (unsigned long i = 0; i < threadCount; i++) {
+            total += counts[i].count;
+        }
         if (stop) {
-            std::cout << "Terminated: " << count << " samples written" << std::endl;
+            std::cout << "Terminated: " << total << " " << unit << " written" << std::endl;
+        } else {
+            std::cout << "Timed out: " << total << " " << unit << " written" << std::endl;
+        }
+        std::cout << "Average write rate: " << fixed << setprecision(0) << (double)total / elapsedTime << " " << unit << "/s" << std::endl;
+        if (m_rate > 0) {
+            std::cout << "Requested rate: " << m_rate * threadCount << " " << unit << "/s, achieved "
+                << setprecision(2) << 100.0 * total / elapsedTime / (m_rate * threadCount) << "%" << std::endl;
+        }
+        if (threadCount > 1) {
+            for (unsigned long i = 0; i < threadCount; i++) {
+                std::cout << "  Thread " << i << ": " << counts[i].count << " " << unit << ", "
+                    << (double)counts[i].count / elapsedTime << " " << unit << "/s" << std::endl;
+            }
+        }
+        if (m_threadCpu) {
+            vector<ExampleThreadCpu> endThreadCpu = exampleGetThreadCpuTimes();
+            endThreadCpu.insert(endThreadCpu.end(), writerThreadCpu.begin(), writerThreadCpu.end());
+            exampleShowThreadCpuTimes(cout, startThreadCpu, endThreadCpu, (unsigned long long)(elapsedTime * NS_IN_ONE_SEC),
+                exampleProcessCpuNanoseconds() - startCpuTime, total, unit);
+        }
+    }
+
+    // Reads the feedback of the reader for the flow of a search step
+    void readFeedback(const string& flowId, SearchStep& step) {
+        VLoanedDataSamples samples = m_thing.select("ThroughputFeedbackInput").flow(flowId).read(SEARCH_FEEDBACK_TIMEOUT);
+        for (auto& sample : samples) {
+            if (sample.getFlowState() == FlowState::ALIVE) {
+                ThroughputFeedback feedback;
+                sample.get(feedback);
+                step.received = feedback.received();
+                step.latencyCount = feedback.latencycount();
+                step.latencyP99 = feedback.latencyp99();
+            }
+        }
+    }
+
+    // Writes at the offered rate for one step of the search and collects the feedback of the reader
+    SearchStep searchStep(unsigned long stepNumber, unsigned long payloadSize, unsigned long long rate,
+            const SearchSettings& settings, WriterMode mode) {
+        SearchStep step;
+        step.offeredRate = rate;
+        step.received = 0;
+        step.latencyCount = 0;
+        step.latencyP99 = 0;
+
+        string flowId = m_thing.getContextId() + EXAMPLE_SEARCH_FLOW_TAG + to_string(stepNumber);
+        atomic<unsigned long long> writtenCount(0);
+
+        m_rate = rate;
+        Timepoint startTime = Clock::now();
+        write(flowId, 0, 1, settings.stepTime, mode, writtenCount);
+        step.written = writtenCount;
+        step.writtenRate = (double)step.written * US_IN_ONE_SEC / Duration<Microseconds>(Clock::now() - startTime);
+        m_rate = 0;
+
+        // Wait until the reader has reported all samples, or until its count stops changing
+        unsigned long long prevReceived = 0;
+        Timepoint changeTime = Clock::now();
+        while (!stop && step.received < step.written && Duration<Milliseconds>(Clock::now() - changeTime) < SEARCH_SETTLE_TIME) {
+            readFeedback(flowId, step);
+            if (step.received != prevReceived) {
+                prevReceived = step.received;
+                changeTime = Clock::now();
+            }
+        }
+
+        step.loss = (step.received < step.written) ? 100.0 * (step.written - step.received) / step.written : 0.0;
+        step.passed = step.written > 0
+            && step.writtenRate >= SEARCH_MIN_WRITTEN_RATE * rate
+            && step.loss <= settings.maxLoss
+            && (settings.maxLatencyP99 == 0 || (step.latencyCount > 0 && step.latencyP99 <= settings.maxLatencyP99 * NS_IN_ONE_US));
+
+        cout << fixed
+            << "Step " << setw(3) << right << stepNumber << " | "
+            << "Payload size: " << payloadSize << " | "
+            << "Offered: " << setw(9) << right << rate << " samples/s | "
+            << "Written: " << setw(9) << right << setprecision(0) << step.writtenRate << " samples/s | "
+            << "Lost: " << setw(6) << right << setprecision(2) << step.loss << "% | "
+            << "p99: ";
+        if (step.latencyCount > 0) {
+            cout << setw(9) << right << setprecision(1) << (double)step.latencyP99 / NS_IN_ONE_US << " us | ";
         } else {
-            std::cout << "Timed out: " << count << " samples written" << std::endl;
+            cout << setw(9) << right << "-" << "    | ";
         }
+        cout << (step.passed ? "pass" : "fail") << endl;
+
+        return step;
     }
 
+    // Searches for each payload size the highest rate at which the reader receives the samples
+    // within the loss and latency limits. The rate is doubled until a step fails, then the rate
+    // is bisected between the highest passing and the lowest failing rate.
+    void searchMaxThroughput(const vector<unsigned long>& payloadSizes, const SearchSettings& settings, WriterMode mode) {
+        vector<SearchStep> results;
+        vector<double> sampleSizes;
+        unsigned long stepNumber = 0;
+
+        for (unsigned long payloadSize : payloadSizes) {
+            SearchStep best;
+            best.offeredRate = 0;
+            best.latencyCount = 0;
+            best.passed = false;
+            unsigned long long low = 0;
+            unsigned long long high = 0;
+            unsigned long long rate = settings.minRate;
+
+            setupMessage(payloadSize);
+            sampleSizes.push_back(getSampleSize(m_meanPayloadSize));
+
+            // Ramp up until a step fails or the maximum rate passes
+            while (!stop) {
+                SearchStep step = searchStep(stepNumber++, payloadSize, rate, settings, mode);
+                if (!step.passed) {
+                    high = rate;
+                    break;
+                }
+                best = step;
+                low = rate;
+                if (settings.maxRate != 0 && rate >= settings.maxRate) {
+                    break;
+                }
+                rate *= 2;
+                if (settings.maxRate != 0 && rate > settings.maxRate) {
+                    rate = settings.maxRate;
+                }
+            }
+
+            // Bisect until the passing and failing rate are within the precision
+            while (!stop && low > 0 && high > low && (double)(high - low) * 100.0 / low > settings.precision) {
+                rate = low + (high - low) / 2;
+                SearchStep step = searchStep(stepNumber++, payloadSize, rate, settings, mode);
+                if (step.passed) {
+                    best = step;
+                    low = rate;
+                } else {
+                    high = rate;
+                }
+            }
+
+            results.push_back(best);
+        }
+
+        // Show the maximum sustainable throughput for each payload size
+        cout << endl << "Maximum sustainable throughput:" << endl
+            << "Payload size |   samples/s |     Mbit/s | p99 latency (us)" << endl;
+        for (size_t i = 0; i < results.size(); i++) {
+            cout << fixed << setw(12) << right << payloadSizes[i] << " | ";
+            if (results[i].passed) {
+                cout << setw(11) << right << results[i].offeredRate << " | "
+                    << setw(10) << right << setprecision(2)
+                    << (double)results[i].offeredRate * sampleSizes[i] / BYTES_PER_SEC_TO_MEGABITS_PER_SEC << " | ";
+                if (results[i].latencyCount > 0) {
+                    cout << setprecision(1) << (double)results[i].latencyP99 / NS_IN_ONE_US;
+                } else {
+                    cout << "-";
+                }
+            } else {
+                cout << "not sustainable at " << settings.minRate << " samples/s";
+            }
+            cout << endl;
+        }
+    }
 
 public:
     ThroughputWriter(string thingPropertiesUri) :
@@ -192,22 +625,67 @@ public:
         cout << "Throughput writer stopped" << endl;
     }
 
-    int run(unsigned long payloadSize, unsigned long burstInterval, unsigned long burstSize, unsigned long runningTime, WriterMode writerMode) {
+    // Writes the samples for each payload size in turn, a sweep when there is more than one
+    int run(const vector<unsigned long>& payloadSizes, unsigned long burstInterval, unsigned long burstSize, unsigned long runningTime, WriterMode writerMode,
+            unsigned long threadCount, double rate, double bandwidth, bool latency, const SearchSettings& search,
+            const ExamplePayloadSettings& payloadSettings, const BatchSettings& batch, bool threadCpu) {
         string writerModeStr = (writerMode == WriterMode::outputHandler) ?
             "outputHandler" : ((writerMode == WriterMode::outputHandlerNotThreadSafe) ?
                 "outputHandlerNotThreadSafe" : "standard");
 
-        cout << "payloadSize: " << payloadSize << " | burstInterval: " << burstInterval
+        cout << "payloadSize: " << payloadSizes.front();
+        if (payloadSizes.size() > 1) {
+            cout << " - " << payloadSizes.back();
+        }
+        cout << " | burstInterval: " << burstInterval
             << " | burstSize: " << burstSize << " | runningTime: " << runningTime
-            << " | writer-mode: " << writerModeStr << endl;
+            << " | writer-mode: " << writerModeStr << " | threads: " << threadCount << " | rate: " << rate << " | bandwidth: " << bandwidth
+            << " | latency: " << (latency ? "on" : "off")
+            << " | payload: " << exampleGetPayloadSettingsName(payloadSettings);
+        if (batch.records > 1) {
+            cout << " | batch: " << batch.records << " records, deadline " << batch.deadline / NS_IN_ONE_US << " us";
+        }
+        cout << endl;
         // Wait for reader to be discovered
         waitForReader();
 
-        // Create the message that is sent
-        setupMessage(payloadSize);
+        m_latency = latency;
+        m_payloadSettings = payloadSettings;
+        m_batch = batch;
+        m_threadCpu = threadCpu;
+        if (search.enabled) {
+            // Search the maximum sustainable throughput for each payload size
+            cout << "Search: rate from " << search.minRate << " samples/s"
+                << " | step time: " << search.stepTime << " s | max loss: " << search.maxLoss << "%"
+                << " | max p99: " << search.maxLatencyP99 << " us" << endl;
+            searchMaxThroughput(payloadSizes, search, writerMode);
+        } else {
+            for (size_t i = 0; i < payloadSizes.size() && !stop; i++) {
+                if (i > 0) {
+                    this_thread::sleep_for(chrono::milliseconds(SWEEP_PAUSE));
+                }
+                if (payloadSizes.size() > 1) {
+                    cout << "Payload size: " << payloadSizes[i] << endl;
+                }
+
+                // Create the messages that are sent
+                setupMessage(payloadSizes[i]);
+                if (m_samples.size() > 1) {
+                    cout << "Pregenerated " << m_samples.size() << " samples, mean payload size: "
+                        << fixed << setprecision(0) << m_meanPayloadSize << " bytes" << endl;
+                }
 
-        // Write data
-        write(burstInterval, burstSize, runningTime, writerMode);
+                // Write data, each thread writes its share of the rate
+                double sizeRate = (bandwidth > 0) ?
+                    bandwidth * BYTES_PER_SEC_TO_MEGABITS_PER_SEC / getSampleSize(m_meanPayloadSize) : rate;
+                m_rate = sizeRate / threadCount;
+
+                // Each step of a sweep has its own flows, so the reader keeps the steps apart
+                // even when the first samples of a step are lost
+                string flowPrefix = (payloadSizes.size() > 1) ? m_thing.getContextId() + EXAMPLE_SWEEP_FLOW_TAG + to_string(i) : "";
+                writeThreads(flowPrefix, threadCount, burstInterval, burstSize, runningTime, writerMode);
+            }
+        }
 
         // Give middleware some time to finish writing samples
         this_thread::sleep_for(chrono::seconds(2));
@@ -217,11 +695,19 @@ public:
 };
 
 static void GetCommandLineParameters(int argc, char *argv[],
-        unsigned long& payloadSize,
+        vector<unsigned long>& payloadSizes,
         unsigned long& burstInterval,
         unsigned long& burstSize,
         unsigned long& runningTime,
-        WriterMode& writerMode
+        WriterMode& writerMode,
+        unsigned long& threadCount,
+        double& rate,
+        double& bandwidth,
+        bool& latency,
+        SearchSettings& search,
+        ExamplePayloadSettings& payload,
+        BatchSettings& batch,
+        ExampleSchedulingSettings& scheduling
 ) {
     cxxopts::Options options("ThroughputWriter", "ADLINK ThingSDK ThroughputWriter");
     try {
@@ -229,8 +715,36 @@ static void GetCommandLineParameters(int argc, char *argv[],
             ("p,payload-size", "Payload size", cxxopts::value<unsigned long>()->default_value("4096"))
             ("b,burst-interval", "Burst interval in milliseconds", cxxopts::value<unsigned long>()->default_value("0"))
             ("s,burst-size", "Burst size", cxxopts::value<unsigned long>()->default_value("1"))
-            ("r,running-time", "Running Time in seconds (0 is infinite)", cxxopts::value<unsigned long>()->default_value("0"))
+            ("r,running-time", "Running Time in seconds (0 is infinite), for each payload size of a sweep", cxxopts::value<unsigned long>()->default_value("0"))
             ("w,writer-mode", "Writer mode (standard, outputHandler, outputHandlerNotThreadSafe)", cxxopts::value<string>()->default_value("standard"))
+            ("t,threads", "Number of writer threads, each thread writes on its own flow", cxxopts::value<unsigned long>()->default_value("1"))
+            ("rate", "Write at a fixed rate in samples/s, the burst size is the size of the token bucket", cxxopts::value<double>()->default_value("0"))
+            ("bandwidth", "Write at a fixed bandwidth in Mbit/s, like the rate", cxxopts::value<double>()->default_value("0"))
+            ("sweep-max", "Sweep the payload size from the payload size up to this size (0 writes a single payload size)", cxxopts::value<unsigned long>()->default_value("0"))
+            ("sweep-factor", "Factor between the payload sizes of a sweep", cxxopts::value<double>()->default_value("2"))
+            ("payload-content", "Content of the payload (constant, random, corpus)", cxxopts::value<string>()->default_value("constant"))
+            ("corpus", "File whose content the corpus payload content replays", cxxopts::value<string>()->default_value(""))
+            ("size-distribution", "Distribution of the payload sizes (fixed, uniform, lognormal, bimodal, trace)", cxxopts::value<string>()->default_value("fixed"))
+            ("size-max", "Maximum payload size of the uniform and lognormal distributions, the large size of the bimodal distribution", cxxopts::value<unsigned long>()->default_value("0"))
+            ("size-sigma", "Standard deviation of the logarithm of the lognormal payload sizes, whose median is the payload size", cxxopts::value<double>()->default_value("1"))
+            ("large-fraction", "Fraction of the samples of the bimodal distribution that have the maximum size", cxxopts::value<double>()->default_value("0.1"))
+            ("size-trace", "File with the payload sizes of the trace distribution, one size per line", cxxopts::value<string>()->default_value(""))
+            ("ring-size", "Number of pregenerated samples the writer cycles through with random content or a size distribution", cxxopts::value<unsigned long>()->default_value("1024"))
+            ("batch", "Pack this many records into the payload of each sample (1 writes each record as a sample)", cxxopts::value<unsigned long>()->default_value("1"))
+            ("batch-deadline", "Time in microseconds after which a batch is written when it is not full", cxxopts::value<unsigned long>()->default_value("1000"))
+            ("l,latency", "Stamp the send time into the payload, so the reader reports end-to-end latency (reader and writer must run on the same host)", cxxopts::value<bool>())
+            ("search", "Search the maximum rate that the reader sustains within the loss and latency limits", cxxopts::value<bool>())
+            ("search-min-rate", "Rate in samples/s at which the search starts", cxxopts::value<unsigned long long>()->default_value("1000"))
+            ("search-max-rate", "Highest rate in samples/s that the search tries (0 doubles the rate until a step fails)", cxxopts::value<unsigned long long>()->default_value("0"))
+            ("search-step-time", "Time in seconds that the search writes at each rate", cxxopts::value<unsigned long>()->default_value("5"))
+            ("search-precision", "The search ends when the passing and failing rate differ by at most this percentage", cxxopts::value<double>()->default_value("5"))
+            ("max-loss", "Maximum percentage of lost samples at a sustainable rate", cxxopts::value<double>()->default_value("0"))
+            ("max-p99", "Maximum p99 latency in us at a sustainable rate (0 is no limit, otherwise latency is enabled)", cxxopts::value<double>()->default_value("0"))
+            ("cpus", "CPUs to run on, for example 0-3,8", cxxopts::value<string>()->default_value(""))
+            ("numa-nodes", "NUMA nodes to allocate memory from, for example 0 (Linux)", cxxopts::value<string>()->default_value(""))
+            ("fifo-priority", "Run with the SCHED_FIFO scheduling policy at this priority (0 keeps the default policy, Linux)", cxxopts::value<int>()->default_value("0"))
+            ("lock-memory", "Lock all current and future memory with mlockall (Linux)", cxxopts::value<bool>())
+            ("thread-cpu", "Show the CPU time of each thread at the end of the run", cxxopts::value<bool>())
             ("h,help", "Print help")
             ;
         options.parse_positional({"payload-size", "burst-interval", "burst-size", "running-time", "writer-mode", "other"});
@@ -243,15 +757,161 @@ static void GetCommandLineParameters(int argc, char *argv[],
             exit(0);
         }
 
-        payloadSize = cmdLineOptions["p"].as<unsigned long>();
+        unsigned long payloadSize = cmdLineOptions["p"].as<unsigned long>();
         burstInterval = cmdLineOptions["b"].as<unsigned long>();
         burstSize = cmdLineOptions["s"].as<unsigned long>();
         runningTime = cmdLineOptions["r"].as<unsigned long>();
+        threadCount = cmdLineOptions["t"].as<unsigned long>();
+        latency = cmdLineOptions["l"].as<bool>();
+        rate = cmdLineOptions["rate"].as<double>();
+        bandwidth = cmdLineOptions["bandwidth"].as<double>();
+
+        // A geometric series of payload sizes; a sweep from 0 continues with 1
+        unsigned long sweepMax = cmdLineOptions["sweep-max"].as<unsigned long>();
+        double sweepFactor = cmdLineOptions["sweep-factor"].as<double>();
+        payloadSizes.assign(1, payloadSize);
+        if (sweepMax > payloadSize) {
+            if (sweepFactor <= 1.0) {
+                cerr << "Invalid sweep factor" << endl << endl;
+                cout << options.help({""}) << endl;
+                exit(1);
+            }
+            unsigned long size = payloadSize;
+            while (size < sweepMax) {
+                size = max(size + 1, (unsigned long)(size * sweepFactor));
+                payloadSizes.push_back(min(size, sweepMax));
+            }
+            if (runningTime == 0) {
+                runningTime = 5;
+            }
+        }
+        unsigned long minPayloadSize = *min_element(payloadSizes.begin(), payloadSizes.end());
+
+        if (rate < 0 || bandwidth < 0 || (rate > 0 && bandwidth > 0)) {
+            cerr << "Specify either a rate or a bandwidth" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+        if (bandwidth > 0 && minPayloadSize == 0) {
+            cerr << "A bandwidth needs a payload" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+        if ((rate > 0 || bandwidth > 0) && burstInterval != 0) {
+            cerr << "A fixed rate cannot be combined with a burst interval" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+
+        batch.records = cmdLineOptions["batch"].as<unsigned long>();
+        batch.deadline = (unsigned long long)cmdLineOptions["batch-deadline"].as<unsigned long>() * NS_IN_ONE_US;
+        if (batch.records == 0) {
+            cerr << "Invalid batch size" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+
+        search.enabled = cmdLineOptions["search"].as<bool>();
+        search.minRate = cmdLineOptions["search-min-rate"].as<unsigned long long>();
+        search.maxRate = cmdLineOptions["search-max-rate"].as<unsigned long long>();
+        search.stepTime = cmdLineOptions["search-step-time"].as<unsigned long>();
+        search.precision = cmdLineOptions["search-precision"].as<double>();
+        search.maxLoss = cmdLineOptions["max-loss"].as<double>();
+        search.maxLatencyP99 = cmdLineOptions["max-p99"].as<double>();
+
+        if (search.enabled) {
+            if (threadCount > 1 || rate > 0 || bandwidth > 0 || batch.records > 1) {
+                cerr << "The search writes on a single flow at the rates it tries, it cannot be combined with threads, a rate or batching" << endl << endl;
+                cout << options.help({""}) << endl;
+                exit(1);
+            }
+            if (search.minRate == 0 || (search.maxRate != 0 && search.maxRate < search.minRate)
+                    || search.stepTime == 0 || search.precision <= 0) {
+                cerr << "Invalid search settings" << endl << endl;
+                cout << options.help({""}) << endl;
+                exit(1);
+            }
+            if (search.maxLatencyP99 > 0) {
+                latency = true;
+            }
+        }
+
+        if (threadCount == 0) {
+            cerr << "Invalid number of threads" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+
+        if (latency && minPayloadSize < EXAMPLE_PAYLOAD_TIMESTAMP_SIZE) {
+            cerr << "Payload size must be at least " << EXAMPLE_PAYLOAD_TIMESTAMP_SIZE << " bytes to hold the send time" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+
+        string content = cmdLineOptions["payload-content"].as<string>();
+        if (content == "constant") {
+            payload.content = PayloadContent::constantContent;
+        } else if (content == "random") {
+            payload.content = PayloadContent::randomContent;
+        } else if (content == "corpus") {
+            payload.content = PayloadContent::corpusContent;
+            if (!exampleReadFile(cmdLineOptions["corpus"].as<string>(), payload.corpus)) {
+                cerr << "Cannot read corpus file " << cmdLineOptions["corpus"].as<string>() << endl << endl;
+                cout << options.help({""}) << endl;
+                exit(1);
+            }
+        } else {
+            cerr << "Invalid payload content" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+
+        string distribution = cmdLineOptions["size-distribution"].as<string>();
+        payload.maxSize = cmdLineOptions["size-max"].as<unsigned long>();
+        payload.sigma = cmdLineOptions["size-sigma"].as<double>();
+        payload.largeFraction = cmdLineOptions["large-fraction"].as<double>();
+        payload.ringSize = cmdLineOptions["ring-size"].as<unsigned long>();
+        if (distribution == "fixed") {
+            payload.distribution = SizeDistribution::fixedSize;
+        } else if (distribution == "uniform") {
+            payload.distribution = SizeDistribution::uniformSize;
+        } else if (distribution == "lognormal") {
+            payload.distribution = SizeDistribution::lognormalSize;
+        } else if (distribution == "bimodal") {
+            payload.distribution = SizeDistribution::bimodalSize;
+        } else if (distribution == "trace") {
+            payload.distribution = SizeDistribution::traceSize;
+            if (!exampleReadSizeTrace(cmdLineOptions["size-trace"].as<string>(), payload.trace)) {
+                cerr << "Cannot read size trace file " << cmdLineOptions["size-trace"].as<string>() << endl << endl;
+                cout << options.help({""}) << endl;
+                exit(1);
+            }
+        } else {
+            cerr << "Invalid size distribution" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+
+        if (payload.ringSize == 0 || payload.sigma <= 0 || payload.largeFraction < 0 || payload.largeFraction > 1
+                || ((payload.distribution == SizeDistribution::uniformSize || payload.distribution == SizeDistribution::bimodalSize)
+                    && payload.maxSize <= *max_element(payloadSizes.begin(), payloadSizes.end()))) {
+            cerr << "Invalid payload settings, the uniform and bimodal distributions need a size-max above the payload size" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
 
         if (cmdLineOptions["w"].as<string>() == "outputHandler") {
             writerMode = WriterMode::outputHandler;
         } else if (cmdLineOptions["w"].as<string>() == "outputHandlerNotThreadSafe") {
             writerMode = WriterMode::outputHandlerNotThreadSafe;
+
+            // The non-reentrant write is set up with a single sample
+            if (payload.distribution != SizeDistribution::fixedSize || batch.records > 1) {
+                cerr << "The outputHandlerNotThreadSafe writer mode writes a single sample, it cannot be combined with a size distribution or batching" << endl << endl;
+                cout << options.help({""}) << endl;
+                exit(1);
+            }
+            payload.ringSize = 1;
         } else if (cmdLineOptions["w"].as<string>() == "standard") {
             writerMode = WriterMode::standard;
         } else {
@@ -259,6 +919,17 @@ static void GetCommandLineParameters(int argc, char *argv[],
             cout << options.help({""}) << endl;
             exit(1);
         }
+
+        if (!exampleParseCpuList(cmdLineOptions["cpus"].as<string>(), scheduling.cpus)
+                || !exampleParseCpuList(cmdLineOptions["numa-nodes"].as<string>(), scheduling.numaNodes)
+                || cmdLineOptions["fifo-priority"].as<int>() < 0) {
+            cerr << "Invalid CPU placement or scheduling settings" << endl << endl;
+            cout << options.help({""}) << endl;
+            exit(1);
+        }
+        scheduling.fifoPriority = cmdLineOptions["fifo-priority"].as<int>();
+        scheduling.lockMemory = cmdLineOptions["lock-memory"].as<bool>();
+        scheduling.threadCpu = cmdLineOptions["thread-cpu"].as<bool>();
     }
     catch (cxxopts::OptionException e) {
         cerr << e.what() << endl << endl;
@@ -271,12 +942,25 @@ static void GetCommandLineParameters(int argc, char *argv[],
 
 int main(int argc, char *argv[]) {
     // Get command line parameters
-    unsigned long payloadSize;
+    vector<unsigned long> payloadSizes;
     unsigned long burstInterval;
     unsigned long burstSize;
     unsigned long runningTime;
+    unsigned long threadCount = 1;
+    double rate = 0;
+    double bandwidth = 0;
+    bool latency = false;
+    SearchSettings search;
+    ExamplePayloadSettings payload;
+    BatchSettings batch;
     WriterMode writerMode = WriterMode::standard;
-    GetCommandLineParameters(argc, argv, payloadSize, burstInterval, burstSize, runningTime, writerMode);
+    ExampleSchedulingSettings scheduling;
+    GetCommandLineParameters(argc, argv, payloadSizes, burstInterval, burstSize, runningTime, writerMode, threadCount, rate, bandwidth, latency, search, payload, batch, scheduling);
+
+    // Place and schedule the process before the Thing starts its threads, so they inherit it
+    if (!exampleApplySchedulingSettings(scheduling)) {
+        return 1;
+    }
 
     // Register handler for Ctrl-C
     registerControlHandler();
@@ -284,7 +968,8 @@ int main(int argc, char *argv[]) {
     try
     {
         return ThroughputWriter("file://./config/ThroughputWriterProperties.json")
-            .run(payloadSize, burstInterval, burstSize, runningTime, writerMode);
+            .run(payloadSizes, burstInterval, burstSize, runningTime, writerMode, threadCount, rate, bandwidth, latency, search, payload, batch,
+                scheduling.threadCpu);
     }
     catch (ThingAPIException e)
     {
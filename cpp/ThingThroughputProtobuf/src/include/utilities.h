@@ -18,13 +18,37 @@
 *
 */
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <random>
 #include <signal.h>
+#include <sstream>
 #include <stdlib.h>
+#include <string>
+#include <thread>
 #include <time.h>
+#include <vector>
 #ifdef _WIN32
 #include <Windows.h>
+#include <TlHelp32.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 #endif
 
 using namespace std;
@@ -32,6 +56,9 @@ using namespace std;
 using Clock = chrono::high_resolution_clock;
 using Timepoint = chrono::time_point<Clock>;
 
+#define NS_IN_ONE_SEC 1000000000LL
+#define NS_IN_ONE_MS 1000000LL
+#define NS_IN_ONE_US 1000LL
 #define US_IN_ONE_SEC 1000000LL
 #define BYTES_PER_SEC_TO_MEGABITS_PER_SEC 125000
 
@@ -44,6 +71,390 @@ unsigned long long Duration(const FromType& d)
     return chrono::duration_cast<ToType>(d).count();
 }
 
+// Monotonic time in nanoseconds, used for the send timestamps in the payload. The steady clock
+// is shared by all processes on a host, so writer and reader must run on the same host.
+static inline unsigned long long exampleNowNanoseconds() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Waiting for a point in time sleeps until EXAMPLE_SPIN_TIME ns before it and spins for the
+// remainder, because a sleep can wake up tens of microseconds late
+#define EXAMPLE_SPIN_TIME 100000
+
+static void exampleWaitUntil(unsigned long long time) {
+    unsigned long long now = exampleNowNanoseconds();
+    if (time > now + EXAMPLE_SPIN_TIME) {
+        this_thread::sleep_for(chrono::nanoseconds(time - now - EXAMPLE_SPIN_TIME));
+    }
+    while (exampleNowNanoseconds() < time) {
+        // spin
+    }
+}
+
+// ExampleRateLimiter is a token bucket that paces writes at a fixed rate. The time at which a
+// token is due is computed from the start time and the number of tokens taken, so late wake-ups
+// and rounding do not add up to a drift of the rate. A writer that fell behind may take at most
+// 'capacity' tokens without waiting.
+typedef struct ExampleRateLimiter {
+    double interval;
+    unsigned long long capacity;
+    unsigned long long start;
+    unsigned long long taken;
+} ExampleRateLimiter;
+
+static ExampleRateLimiter exampleInitRateLimiter(double rate, unsigned long long capacity) {
+    ExampleRateLimiter limiter;
+    limiter.interval = (rate > 0) ? NS_IN_ONE_SEC / rate : 0;
+    limiter.capacity = (capacity > 0) ? capacity : 1;
+    limiter.start = exampleNowNanoseconds();
+    limiter.taken = 0;
+
+    return limiter;
+}
+
+// Returns the time at which the next token is due
+static unsigned long long exampleGetRateLimiterDue(const ExampleRateLimiter& limiter) {
+    return limiter.start + (unsigned long long)(limiter.taken * limiter.interval);
+}
+
+// Waits until the next token is due and takes it
+static void exampleAcquireRateLimiter(ExampleRateLimiter& limiter) {
+    unsigned long long now = exampleNowNanoseconds();
+    unsigned long long due = exampleGetRateLimiterDue(limiter);
+    unsigned long long backlog = (unsigned long long)(limiter.capacity * limiter.interval);
+
+    if (now > due + backlog) {
+        // Fell behind by more than a full bucket, move the schedule forward
+        limiter.start += now - (due + backlog);
+        due = now - backlog;
+    }
+    if (due > now) {
+        exampleWaitUntil(due);
+    }
+    limiter.taken++;
+}
+
+// Returns the CPU time (user + system) consumed by all threads of this process, including
+// the threads of the Edge SDK, in nanoseconds
+static unsigned long long exampleProcessCpuNanoseconds() {
+#ifdef _WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+        return 0;
+    }
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernelTime.dwLowDateTime;
+    kernel.HighPart = kernelTime.dwHighDateTime;
+    user.LowPart = userTime.dwLowDateTime;
+    user.HighPart = userTime.dwHighDateTime;
+
+    return (kernel.QuadPart + user.QuadPart) * 100;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+
+    return (unsigned long long)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * NS_IN_ONE_SEC
+        + (unsigned long long)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000;
+#endif
+}
+
+// Returns the CPU time (user + system) consumed by the calling thread, in nanoseconds
+static unsigned long long exampleThreadCpuNanoseconds() {
+#ifdef _WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+        return 0;
+    }
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernelTime.dwLowDateTime;
+    kernel.HighPart = kernelTime.dwHighDateTime;
+    user.LowPart = userTime.dwLowDateTime;
+    user.HighPart = userTime.dwHighDateTime;
+
+    return (kernel.QuadPart + user.QuadPart) * 100;
+#elif defined(RUSAGE_THREAD)
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) != 0) {
+        return 0;
+    }
+
+    return (unsigned long long)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * NS_IN_ONE_SEC
+        + (unsigned long long)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000;
+#else
+    struct timespec time;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0) {
+        return 0;
+    }
+
+    return (unsigned long long)time.tv_sec * NS_IN_ONE_SEC + time.tv_nsec;
+#endif
+}
+
+// The CPU time that one thread of this process consumed
+typedef struct ExampleThreadCpu {
+    unsigned long long id;
+    string name;
+    unsigned long long cpuTime;
+} ExampleThreadCpu;
+
+// Returns the CPU time of the calling thread, for a thread that reports itself before it exits
+static ExampleThreadCpu exampleGetCurrentThreadCpu(const string& name) {
+    ExampleThreadCpu thread;
+#ifdef _WIN32
+    thread.id = GetCurrentThreadId();
+#elif defined(__linux__)
+    thread.id = (unsigned long long)syscall(SYS_gettid);
+#else
+    thread.id = 0;
+#endif
+    thread.name = name;
+    thread.cpuTime = exampleThreadCpuNanoseconds();
+
+    return thread;
+}
+
+// Returns the CPU time of every running thread of this process, including the threads of the
+// Edge SDK. On Linux the times come from procfs, in clock ticks.
+static vector<ExampleThreadCpu> exampleGetThreadCpuTimes() {
+    vector<ExampleThreadCpu> threads;
+#ifdef _WIN32
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (snapshot == INVALID_HANDLE_VALUE) {
+        return threads;
+    }
+    THREADENTRY32 entry;
+    entry.dwSize = sizeof(entry);
+    for (BOOL found = Thread32First(snapshot, &entry); found; found = Thread32Next(snapshot, &entry)) {
+        if (entry.th32OwnerProcessID != GetCurrentProcessId()) {
+            continue;
+        }
+        HANDLE handle = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, entry.th32ThreadID);
+        if (handle == NULL) {
+            continue;
+        }
+        FILETIME creationTime, exitTime, kernelTime, userTime;
+        if (GetThreadTimes(handle, &creationTime, &exitTime, &kernelTime, &userTime)) {
+            ULARGE_INTEGER kernel, user;
+            kernel.LowPart = kernelTime.dwLowDateTime;
+            kernel.HighPart = kernelTime.dwHighDateTime;
+            user.LowPart = userTime.dwLowDateTime;
+            user.HighPart = userTime.dwHighDateTime;
+            threads.push_back({ entry.th32ThreadID, "", (kernel.QuadPart + user.QuadPart) * 100 });
+        }
+        CloseHandle(handle);
+    }
+    CloseHandle(snapshot);
+#elif defined(__linux__)
+    DIR* tasks = opendir("/proc/self/task");
+    if (tasks == NULL) {
+        return threads;
+    }
+    long ticksPerSecond = sysconf(_SC_CLK_TCK);
+    struct dirent* task;
+    while ((task = readdir(tasks)) != NULL) {
+        if (task->d_name[0] == '.') {
+            continue;
+        }
+        ifstream in(string("/proc/self/task/") + task->d_name + "/stat");
+        string stat;
+        if (!getline(in, stat)) {
+            continue;
+        }
+
+        // The thread name is in parentheses and may contain spaces; utime and stime are the
+        // 12th and 13th field after it
+        size_t nameStart = stat.find('(');
+        size_t nameEnd = stat.rfind(')');
+        if (nameStart == string::npos || nameEnd == string::npos || nameEnd + 2 > stat.size()) {
+            continue;
+        }
+        istringstream fields(stat.substr(nameEnd + 2));
+        string field;
+        for (int i = 0; i < 11; i++) {
+            fields >> field;
+        }
+        unsigned long long userTicks, systemTicks;
+        if (fields >> userTicks >> systemTicks) {
+            threads.push_back({ strtoull(task->d_name, NULL, 10), stat.substr(nameStart + 1, nameEnd - nameStart - 1),
+                (userTicks + systemTicks) * NS_IN_ONE_SEC / ticksPerSecond });
+        }
+    }
+    closedir(tasks);
+#endif
+
+    return threads;
+}
+
+// Shows the CPU time that each thread consumed between two snapshots, and the work done per
+// CPU-second of the whole process. Threads that exited before the end snapshot are only in the
+// process CPU time, unless they reported themselves with exampleGetCurrentThreadCpu.
+static void exampleShowThreadCpuTimes(ostream& out, const vector<ExampleThreadCpu>& start, vector<ExampleThreadCpu> end,
+        unsigned long long elapsedTime, unsigned long long processCpuTime, unsigned long long work, const string& unit) {
+    for (ExampleThreadCpu& thread : end) {
+        for (const ExampleThreadCpu& startThread : start) {
+            if (startThread.id == thread.id) {
+                thread.cpuTime -= min(thread.cpuTime, startThread.cpuTime);
+                break;
+            }
+        }
+    }
+    sort(end.begin(), end.end(), [](const ExampleThreadCpu& a, const ExampleThreadCpu& b) {
+        return a.cpuTime > b.cpuTime;
+    });
+
+    double seconds = (double)elapsedTime / NS_IN_ONE_SEC;
+    out << fixed << "CPU time per thread over " << setprecision(1) << seconds << " s:" << endl;
+    for (const ExampleThreadCpu& thread : end) {
+        out << "  " << setw(8) << right << thread.id << "  " << setw(16) << left << thread.name
+            << setw(10) << right << setprecision(1) << (double)thread.cpuTime / NS_IN_ONE_MS << " ms"
+            << setw(8) << right << (seconds > 0 ? (double)thread.cpuTime / NS_IN_ONE_SEC * 100 / seconds : 0.0) << "%" << endl;
+    }
+    out << "Process CPU time: " << setprecision(1) << (double)processCpuTime / NS_IN_ONE_MS << " ms, "
+        << (seconds > 0 ? (double)processCpuTime / NS_IN_ONE_SEC * 100 / seconds : 0.0) << "% of one core";
+    if (!unit.empty() && processCpuTime > 0) {
+        out << ", " << setprecision(0) << (double)work * NS_IN_ONE_SEC / processCpuTime << " " << unit << " per CPU-second";
+    }
+    out << endl;
+    out.unsetf(ios_base::floatfield);
+}
+
+// Names the calling thread, so it can be told apart in the CPU time per thread (Linux)
+static void exampleSetThreadName(const string& name) {
+#ifdef __linux__
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+#endif
+}
+
+// CPU placement and scheduling of the process, set before any thread is started
+typedef struct ExampleSchedulingSettings {
+    vector<unsigned int> cpus;
+    vector<unsigned int> numaNodes;
+    int fifoPriority;
+    bool lockMemory;
+    bool threadCpu;
+} ExampleSchedulingSettings;
+
+#define EXAMPLE_CPU_LIST_MAX 65536
+#define EXAMPLE_NUMA_MAX_NODES 1024
+#define EXAMPLE_MPOL_BIND 2
+
+// Parses a list of CPUs or NUMA nodes such as "0-3,8"; an empty list is valid
+static bool exampleParseCpuList(const string& list, vector<unsigned int>& result) {
+    istringstream in(list);
+    string range;
+    while (getline(in, range, ',')) {
+        unsigned long first, last;
+        char separator;
+        istringstream values(range);
+        if (!(values >> first)) {
+            return false;
+        }
+        if (values >> separator) {
+            if (separator != '-' || !(values >> last) || last < first) {
+                return false;
+            }
+        } else {
+            last = first;
+        }
+        if (last >= EXAMPLE_CPU_LIST_MAX) {
+            return false;
+        }
+        if (!values.eof() && values.peek() != EOF) {
+            return false;
+        }
+        for (unsigned long value = first; value <= last; value++) {
+            result.push_back((unsigned int)value);
+        }
+    }
+
+    return true;
+}
+
+// Applies the scheduling settings to the calling thread. Threads started afterwards, including
+// the threads of the Edge SDK, inherit the CPU set, the memory policy and the scheduling policy,
+// so this is called from main before the Thing is created.
+static bool exampleApplySchedulingSettings(const ExampleSchedulingSettings& settings) {
+#ifdef __linux__
+    if (!settings.cpus.empty()) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (unsigned int cpu : settings.cpus) {
+            if (cpu >= CPU_SETSIZE) {
+                cerr << "ERROR: CPU " << cpu << " is out of range" << endl;
+                return false;
+            }
+            CPU_SET(cpu, &cpus);
+        }
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+            cerr << "ERROR: Cannot set the CPU affinity: " << strerror(errno) << endl;
+            return false;
+        }
+    }
+
+    if (!settings.numaNodes.empty()) {
+        // set_mempolicy is called directly, so the examples do not depend on libnuma
+        const size_t wordBits = 8 * sizeof(unsigned long);
+        unsigned long nodes[EXAMPLE_NUMA_MAX_NODES / wordBits] = { 0 };
+        for (unsigned int node : settings.numaNodes) {
+            if (node >= EXAMPLE_NUMA_MAX_NODES) {
+                cerr << "ERROR: NUMA node " << node << " is out of range" << endl;
+                return false;
+            }
+            nodes[node / wordBits] |= 1UL << (node % wordBits);
+        }
+        if (syscall(SYS_set_mempolicy, EXAMPLE_MPOL_BIND, nodes, EXAMPLE_NUMA_MAX_NODES + 1) != 0) {
+            cerr << "ERROR: Cannot bind the memory to the NUMA nodes: " << strerror(errno) << endl;
+            return false;
+        }
+    }
+
+    if (settings.fifoPriority > 0) {
+        struct sched_param param;
+        param.sched_priority = settings.fifoPriority;
+        if (sched_setscheduler(0, SCHED_FIFO, &param) != 0) {
+            cerr << "ERROR: Cannot set SCHED_FIFO priority " << settings.fifoPriority << " (" << sched_get_priority_min(SCHED_FIFO)
+                << ".." << sched_get_priority_max(SCHED_FIFO) << "): " << strerror(errno) << endl;
+            return false;
+        }
+    }
+
+    if (settings.lockMemory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        cerr << "ERROR: Cannot lock the memory: " << strerror(errno) << endl;
+        return false;
+    }
+#else
+#ifdef _WIN32
+    if (!settings.cpus.empty()) {
+        DWORD_PTR mask = 0;
+        for (unsigned int cpu : settings.cpus) {
+            if (cpu >= 8 * sizeof(DWORD_PTR)) {
+                cerr << "ERROR: CPU " << cpu << " is out of range" << endl;
+                return false;
+            }
+            mask |= (DWORD_PTR)1 << cpu;
+        }
+        if (!SetProcessAffinityMask(GetCurrentProcess(), mask)) {
+            cerr << "ERROR: Cannot set the CPU affinity" << endl;
+            return false;
+        }
+    }
+#else
+    if (!settings.cpus.empty()) {
+        cerr << "ERROR: The CPU affinity is not supported on this platform" << endl;
+        return false;
+    }
+#endif
+    if (!settings.numaNodes.empty() || settings.fifoPriority > 0 || settings.lockMemory) {
+        cerr << "ERROR: NUMA binding, SCHED_FIFO and memory locking are only supported on Linux" << endl;
+        return false;
+    }
+#endif
+
+    return true;
+}
+
 static atomic<bool> stop(false);
 
 #ifndef _WIN32
@@ -75,4 +486,674 @@ static void unregisterControlHandler() {
 #else
     sigaction(SIGINT,&oldAction, 0);
 #endif
-}
\ No newline at end of file
+}
+// Output of the measurements: text for humans, or one JSON object or CSV row per record
+enum OutputFormat {
+    text,
+    jsonl,
+    csv
+};
+
+static string exampleHostName() {
+    char name[256] = "";
+#ifdef _WIN32
+    DWORD size = sizeof(name);
+    if (!GetComputerNameA(name, &size)) {
+        return "unknown";
+    }
+#else
+    if (gethostname(name, sizeof(name) - 1) != 0) {
+        return "unknown";
+    }
+#endif
+
+    return name;
+}
+
+// Compiler, build type and build time of the example, to tell the records of different builds apart
+static string exampleBuildInfo() {
+    ostringstream info;
+#if defined(__clang__)
+    info << "clang " << __clang_major__ << "." << __clang_minor__ << "." << __clang_patchlevel__;
+#elif defined(__GNUC__)
+    info << "gcc " << __GNUC__ << "." << __GNUC_MINOR__ << "." << __GNUC_PATCHLEVEL__;
+#elif defined(_MSC_VER)
+    info << "msvc " << _MSC_VER;
+#endif
+#ifdef NDEBUG
+    info << " release";
+#else
+    info << " debug";
+#endif
+    info << " " << __DATE__ << " " << __TIME__;
+
+    return info.str();
+}
+
+static string exampleJsonString(const string& value) {
+    string json = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            json += '\\';
+        }
+        json += c;
+    }
+
+    return json + "\"";
+}
+
+// When the writer runs with --latency, the first bytes of the payload hold a marker and the time
+// the sample was written, so the reader can compute the end-to-end latency of each sample
+#define EXAMPLE_PAYLOAD_TIMESTAMPED 0x504D415453454D49ULL
+
+typedef struct ExamplePayloadTimestamp {
+    unsigned long long magic;
+    unsigned long long sendTime;
+} ExamplePayloadTimestamp;
+
+#define EXAMPLE_PAYLOAD_TIMESTAMP_SIZE sizeof(ExamplePayloadTimestamp)
+
+static void exampleWritePayloadTimestamp(unsigned char* payload, unsigned long long sendTime) {
+    ExamplePayloadTimestamp timestamp;
+    timestamp.magic = EXAMPLE_PAYLOAD_TIMESTAMPED;
+    timestamp.sendTime = sendTime;
+    memcpy(payload, &timestamp, EXAMPLE_PAYLOAD_TIMESTAMP_SIZE);
+}
+
+// Returns false if the payload does not contain a send timestamp
+static bool exampleReadPayloadTimestamp(const unsigned char* payload, size_t payloadSize, unsigned long long& sendTime) {
+    ExamplePayloadTimestamp timestamp;
+    if (payloadSize < EXAMPLE_PAYLOAD_TIMESTAMP_SIZE) {
+        return false;
+    }
+
+    memcpy(&timestamp, payload, EXAMPLE_PAYLOAD_TIMESTAMP_SIZE);
+    if (timestamp.magic != EXAMPLE_PAYLOAD_TIMESTAMPED) {
+        return false;
+    }
+    sendTime = timestamp.sendTime;
+
+    return true;
+}
+
+// When the writer runs with --batch, the payload of a sample holds a batch of records: a batch
+// header, followed by the records, each preceded by its size. A record is a payload as written
+// without batching, so it starts with the send timestamp when the writer runs with --latency.
+#define EXAMPLE_PAYLOAD_BATCHED 0x48435441424D4149ULL
+
+typedef struct ExampleBatchHeader {
+    unsigned long long magic;
+    unsigned long long recordCount;
+} ExampleBatchHeader;
+
+typedef unsigned int ExampleBatchRecordSize;
+
+#define EXAMPLE_BATCH_HEADER_SIZE sizeof(ExampleBatchHeader)
+
+// Empties the batch, leaving room for the header. The buffer is a vector of bytes or a string.
+template<typename Buffer>
+static void exampleStartBatch(Buffer& batch) {
+    batch.assign(EXAMPLE_BATCH_HEADER_SIZE, 0);
+}
+
+template<typename Buffer>
+static void exampleAddBatchRecord(Buffer& batch, const unsigned char* record, size_t size) {
+    ExampleBatchRecordSize recordSize = (ExampleBatchRecordSize)size;
+    const unsigned char* sizeBytes = (const unsigned char*)&recordSize;
+    batch.insert(batch.end(), sizeBytes, sizeBytes + sizeof(recordSize));
+    batch.insert(batch.end(), record, record + size);
+}
+
+// Writes the header, once all records are added
+template<typename Buffer>
+static void exampleFinishBatch(Buffer& batch, unsigned long long recordCount) {
+    ExampleBatchHeader header;
+    header.magic = EXAMPLE_PAYLOAD_BATCHED;
+    header.recordCount = recordCount;
+    memcpy(&batch[0], &header, EXAMPLE_BATCH_HEADER_SIZE);
+}
+
+// Walks through the records of a batch in the received payload, without copying them
+typedef struct ExampleBatchReader {
+    const unsigned char* next;
+    const unsigned char* end;
+    unsigned long long remaining;
+} ExampleBatchReader;
+
+// Returns false if the payload does not hold a batch
+static bool exampleStartBatchReader(ExampleBatchReader& reader, const unsigned char* payload, size_t payloadSize) {
+    ExampleBatchHeader header;
+    if (payloadSize < EXAMPLE_BATCH_HEADER_SIZE) {
+        return false;
+    }
+
+    memcpy(&header, payload, EXAMPLE_BATCH_HEADER_SIZE);
+    if (header.magic != EXAMPLE_PAYLOAD_BATCHED) {
+        return false;
+    }
+    reader.next = payload + EXAMPLE_BATCH_HEADER_SIZE;
+    reader.end = payload + payloadSize;
+    reader.remaining = header.recordCount;
+
+    return true;
+}
+
+// Returns false after the last record, or at a record that does not fit in the payload
+static bool exampleNextBatchRecord(ExampleBatchReader& reader, const unsigned char*& record, size_t& size) {
+    ExampleBatchRecordSize recordSize;
+    if (reader.remaining == 0 || (size_t)(reader.end - reader.next) < sizeof(recordSize)) {
+        return false;
+    }
+
+    memcpy(&recordSize, reader.next, sizeof(recordSize));
+    if (recordSize > (size_t)(reader.end - reader.next) - sizeof(recordSize)) {
+        return false;
+    }
+    record = reader.next + sizeof(recordSize);
+    size = recordSize;
+    reader.next = record + recordSize;
+    reader.remaining--;
+
+    return true;
+}
+
+// Content of the payloads written by the writer:
+//    constantContent = all bytes 'a'
+//    randomContent = random bytes
+//    corpusContent = consecutive parts of a corpus file
+enum PayloadContent {
+    constantContent,
+    randomContent,
+    corpusContent
+};
+
+// Distribution of the payload sizes:
+//    fixedSize = the payload size
+//    uniformSize = uniform between the payload size and the maximum size
+//    lognormalSize = lognormal with the payload size as median, up to the maximum size
+//    bimodalSize = the payload size, or the maximum size for a fraction of the samples
+//    traceSize = the sizes in a trace file, one size per line
+enum SizeDistribution {
+    fixedSize,
+    uniformSize,
+    lognormalSize,
+    bimodalSize,
+    traceSize
+};
+
+typedef struct ExamplePayloadSettings {
+    PayloadContent content;
+    vector<unsigned char> corpus;
+    SizeDistribution distribution;
+    unsigned long maxSize;
+    double sigma;
+    double largeFraction;
+    vector<unsigned long> trace;
+    unsigned long ringSize;
+} ExamplePayloadSettings;
+
+static string exampleGetPayloadSettingsName(const ExamplePayloadSettings& settings) {
+    const char* contentNames[] = {"constant", "random", "corpus"};
+    const char* distributionNames[] = {"fixed", "uniform", "lognormal", "bimodal", "trace"};
+    return string(contentNames[settings.content]) + " content, " + distributionNames[settings.distribution] + " sizes";
+}
+
+// The payloads are pregenerated into a ring of samples, of at most this many bytes for each
+// writer thread. The generator uses a fixed seed, so each run writes the same payloads.
+#define EXAMPLE_PAYLOAD_RING_MAX_BYTES (64ULL * 1024 * 1024)
+#define EXAMPLE_PAYLOAD_SEED 1
+
+static bool exampleReadFile(const string& fileName, vector<unsigned char>& data) {
+    ifstream file(fileName, ios::binary);
+    if (!file) {
+        return false;
+    }
+    data.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+
+    return !data.empty();
+}
+
+static bool exampleReadSizeTrace(const string& fileName, vector<unsigned long>& sizes) {
+    ifstream file(fileName);
+    unsigned long size;
+    while (file >> size) {
+        sizes.push_back(size);
+    }
+
+    return !sizes.empty();
+}
+
+// Returns the payload sizes of the ring of samples, each of at least minSize bytes. The trace
+// distribution replays the first sizes of the trace that fit in the ring.
+static vector<unsigned long> exampleGeneratePayloadSizes(unsigned long payloadSize, unsigned long minSize,
+        const ExamplePayloadSettings& settings, mt19937_64& generator) {
+    uniform_int_distribution<unsigned long> uniform(payloadSize, max(payloadSize, settings.maxSize));
+    lognormal_distribution<double> lognormal(log((double)max(payloadSize, 1UL)), settings.sigma);
+    bernoulli_distribution large(settings.largeFraction);
+    vector<unsigned long> sizes;
+    unsigned long long totalSize = 0;
+
+    // A single sample holds constant payloads of a fixed size
+    size_t count = settings.ringSize;
+    if (settings.distribution == SizeDistribution::fixedSize && settings.content == PayloadContent::constantContent) {
+        count = 1;
+    } else if (settings.distribution == SizeDistribution::traceSize) {
+        count = min(count, settings.trace.size());
+    }
+
+    while (sizes.size() < count && (sizes.empty() || totalSize < EXAMPLE_PAYLOAD_RING_MAX_BYTES)) {
+        unsigned long size;
+        switch (settings.distribution) {
+        case SizeDistribution::uniformSize:
+            size = uniform(generator);
+            break;
+        case SizeDistribution::lognormalSize:
+            size = (unsigned long)lognormal(generator);
+            if (settings.maxSize > 0) {
+                size = min(size, settings.maxSize);
+            }
+            break;
+        case SizeDistribution::bimodalSize:
+            size = large(generator) ? settings.maxSize : payloadSize;
+            break;
+        case SizeDistribution::traceSize:
+            size = settings.trace[sizes.size()];
+            break;
+        default:
+            size = payloadSize;
+        }
+        size = max(size, minSize);
+        sizes.push_back(size);
+        totalSize += size;
+    }
+
+    return sizes;
+}
+
+// Fills a payload with the configured content. The corpus offset continues in the corpus
+// where the previous payload ended, so the payloads differ.
+static void exampleFillPayload(unsigned char* payload, size_t size, const ExamplePayloadSettings& settings,
+        mt19937_64& generator, size_t& corpusOffset) {
+    switch (settings.content) {
+    case PayloadContent::randomContent:
+        for (size_t i = 0; i < size; i += sizeof(unsigned long long)) {
+            unsigned long long value = generator();
+            memcpy(payload + i, &value, min(sizeof(value), size - i));
+        }
+        break;
+    case PayloadContent::corpusContent:
+        for (size_t filled = 0; filled < size; ) {
+            size_t chunk = min(size - filled, settings.corpus.size() - corpusOffset);
+            memcpy(payload + filled, &settings.corpus[corpusOffset], chunk);
+            filled += chunk;
+            corpusOffset = (corpusOffset + chunk) % settings.corpus.size();
+        }
+        break;
+    default:
+        memset(payload, 'a', size);
+    }
+}
+
+// The maximum sustainable throughput search writes each step on its own flow, named
+// <writer context>.search.<step>. The reader sends feedback for these flows only.
+#define EXAMPLE_SEARCH_FLOW_TAG ".search."
+
+// A payload size sweep writes each payload size on its own flows, named
+// <writer context>.sweep.<step>, followed by .<thread> with more than one writer thread
+#define EXAMPLE_SWEEP_FLOW_TAG ".sweep."
+
+// The reader keeps a sliding window of the last EXAMPLE_SEQUENCE_WINDOW sequence numbers of each
+// flow as a bitmap, to tell reordered and duplicate samples from lost ones in constant time.
+#define EXAMPLE_SEQUENCE_WINDOW 1024
+#define EXAMPLE_SEQUENCE_WORD_BITS 64
+
+typedef struct ExampleSequenceTracker {
+    bool started;
+    unsigned long long highest;
+    unsigned long long received[EXAMPLE_SEQUENCE_WINDOW / EXAMPLE_SEQUENCE_WORD_BITS];
+} ExampleSequenceTracker;
+
+// Sequence number accounting of one sample, or the totals of a flow or a run:
+// lost       skipped sequence numbers that were not received (yet)
+// reordered  samples received after a higher sequence number, within the window
+// late       samples older than the window, counted lost when they were skipped
+// duplicate  samples received before within the window
+// maxGap     longest run of sequence numbers skipped at once
+typedef struct ExampleSequenceCounts {
+    unsigned long long lost;
+    unsigned long long reordered;
+    unsigned long long late;
+    unsigned long long duplicate;
+    unsigned long long maxGap;
+} ExampleSequenceCounts;
+
+static inline bool exampleSequenceReceived(const ExampleSequenceTracker& tracker, unsigned long long sequenceNumber) {
+    unsigned long long bit = sequenceNumber % EXAMPLE_SEQUENCE_WINDOW;
+    return (tracker.received[bit / EXAMPLE_SEQUENCE_WORD_BITS] >> (bit % EXAMPLE_SEQUENCE_WORD_BITS)) & 1;
+}
+
+static inline void exampleSetSequenceReceived(ExampleSequenceTracker& tracker, unsigned long long sequenceNumber, bool received) {
+    unsigned long long bit = sequenceNumber % EXAMPLE_SEQUENCE_WINDOW;
+    unsigned long long mask = 1ULL << (bit % EXAMPLE_SEQUENCE_WORD_BITS);
+    if (received) {
+        tracker.received[bit / EXAMPLE_SEQUENCE_WORD_BITS] |= mask;
+    } else {
+        tracker.received[bit / EXAMPLE_SEQUENCE_WORD_BITS] &= ~mask;
+    }
+}
+
+// Clears the sequence numbers from first up to, not including, end. The bits are cleared a word
+// at a time, so a gap within the window takes at most one operation per word of the window.
+static void exampleClearSequenceRange(ExampleSequenceTracker& tracker, unsigned long long first, unsigned long long end) {
+    while (first < end) {
+        unsigned long long bit = first % EXAMPLE_SEQUENCE_WINDOW;
+        unsigned long long offset = bit % EXAMPLE_SEQUENCE_WORD_BITS;
+        unsigned long long count = min(end - first, EXAMPLE_SEQUENCE_WORD_BITS - offset);
+        unsigned long long mask = (count == EXAMPLE_SEQUENCE_WORD_BITS) ? ~0ULL : ((1ULL << count) - 1) << offset;
+        tracker.received[bit / EXAMPLE_SEQUENCE_WORD_BITS] &= ~mask;
+        first += count;
+    }
+}
+
+// Restarts the tracking at the next sample, e.g. when a sweep restarts the sequence numbers
+static void exampleResetSequenceTracker(ExampleSequenceTracker& tracker) {
+    tracker.started = false;
+}
+
+// Returns the accounting of the sample with this sequence number. A gap is counted lost
+// immediately and moved to reordered when its samples arrive within the window.
+static ExampleSequenceCounts exampleTrackSequence(ExampleSequenceTracker& tracker, unsigned long long sequenceNumber) {
+    ExampleSequenceCounts counts = ExampleSequenceCounts();
+
+    if (!tracker.started) {
+        memset(tracker.received, 0, sizeof(tracker.received));
+        tracker.started = true;
+        tracker.highest = sequenceNumber;
+    } else if (sequenceNumber > tracker.highest) {
+        counts.lost = counts.maxGap = sequenceNumber - tracker.highest - 1;
+
+        // Forget the sequence numbers that leave the window
+        if (sequenceNumber - tracker.highest >= EXAMPLE_SEQUENCE_WINDOW) {
+            memset(tracker.received, 0, sizeof(tracker.received));
+        } else {
+            exampleClearSequenceRange(tracker, tracker.highest + 1, sequenceNumber);
+        }
+        tracker.highest = sequenceNumber;
+    } else if (tracker.highest - sequenceNumber >= EXAMPLE_SEQUENCE_WINDOW) {
+        // Too old to tell from a duplicate
+        counts.late = 1;
+        return counts;
+    } else if (exampleSequenceReceived(tracker, sequenceNumber)) {
+        counts.duplicate = 1;
+        return counts;
+    } else {
+        counts.reordered = 1;
+    }
+    exampleSetSequenceReceived(tracker, sequenceNumber, true);
+
+    return counts;
+}
+
+static ExampleSequenceCounts& operator+=(ExampleSequenceCounts& counts, const ExampleSequenceCounts& sample) {
+    // A reordered sample fills a gap that was counted lost
+    counts.lost = counts.lost + sample.lost - min(counts.lost + sample.lost, sample.reordered);
+    counts.reordered += sample.reordered;
+    counts.late += sample.late;
+    counts.duplicate += sample.duplicate;
+    counts.maxGap = max(counts.maxGap, sample.maxGap);
+
+    return counts;
+}
+
+// ExampleTimeline keeps the throughput of short intervals (buckets) in a ring that covers the
+// last part of the run, so stalls that an average over a second hides can be found afterwards.
+// Each bucket holds the samples and bytes read in it and the longest time between two reads that
+// ended in it.
+typedef struct ExampleTimelineBucket {
+    unsigned long long samples;
+    unsigned long long bytes;
+    unsigned long long maxGap;
+} ExampleTimelineBucket;
+
+typedef struct ExampleTimeline {
+    vector<ExampleTimelineBucket> buckets;
+    unsigned long long bucketTime;
+    bool started;
+    unsigned long long startTime;
+    // Index since the start of the last bucket written, and the time of the last read
+    unsigned long long last;
+    unsigned long long lastReadTime;
+} ExampleTimeline;
+
+static ExampleTimeline exampleInitTimeline(unsigned long long bucketTime, size_t bucketCount) {
+    ExampleTimeline timeline;
+    timeline.buckets.assign(bucketCount, ExampleTimelineBucket());
+    timeline.bucketTime = bucketTime;
+    timeline.started = false;
+    timeline.startTime = 0;
+    timeline.last = 0;
+    timeline.lastReadTime = 0;
+
+    return timeline;
+}
+
+// Adds the samples and bytes of one read at readTime (ns, monotonic)
+static void exampleAddToTimeline(ExampleTimeline& timeline, unsigned long long readTime, unsigned long long samples,
+        unsigned long long bytes) {
+    if (!timeline.started) {
+        timeline.started = true;
+        timeline.startTime = readTime;
+        timeline.lastReadTime = readTime;
+    }
+
+    size_t bucketCount = timeline.buckets.size();
+    unsigned long long index = (readTime - timeline.startTime) / timeline.bucketTime;
+    if (index > timeline.last) {
+        // Clear the buckets without reads, and the buckets the ring reuses
+        for (unsigned long long i = timeline.last + 1; i <= index && i <= timeline.last + bucketCount; i++) {
+            timeline.buckets[i % bucketCount] = ExampleTimelineBucket();
+        }
+        timeline.last = index;
+    }
+
+    ExampleTimelineBucket& bucket = timeline.buckets[index % bucketCount];
+    bucket.samples += samples;
+    bucket.bytes += bytes;
+    bucket.maxGap = max(bucket.maxGap, readTime - timeline.lastReadTime);
+    timeline.lastReadTime = readTime;
+}
+
+// Writes the buckets in the ring as csv, with the time in ms since the first read
+static void exampleWriteTimeline(const ExampleTimeline& timeline, ostream& out) {
+    size_t bucketCount = timeline.buckets.size();
+    unsigned long long first = (timeline.last >= bucketCount) ? timeline.last - bucketCount + 1 : 0;
+
+    out << "time_ms,samples,bytes,max_gap_us" << endl;
+    if (!timeline.started) {
+        return;
+    }
+    out << fixed << setprecision(1);
+    for (unsigned long long i = first; i <= timeline.last; i++) {
+        const ExampleTimelineBucket& bucket = timeline.buckets[i % bucketCount];
+        out << (double)i * timeline.bucketTime / NS_IN_ONE_MS << "," << bucket.samples << "," << bucket.bytes << ","
+            << (double)bucket.maxGap / NS_IN_ONE_US << endl;
+    }
+    out.unsetf(ios_base::floatfield);
+}
+
+// ExampleTimeStats is a log-linear (HDR-style) histogram with a fixed memory footprint:
+// values below 2 * EXAMPLE_STATS_SUB_BUCKETS are counted exactly, larger values are counted in
+// EXAMPLE_STATS_SUB_BUCKETS linear sub-buckets per power of two, which bounds the relative
+// error of a reported percentile to 1 / EXAMPLE_STATS_SUB_BUCKETS (< 1%).
+#define EXAMPLE_STATS_SUB_BUCKET_BITS 7
+#define EXAMPLE_STATS_SUB_BUCKETS (1ULL << EXAMPLE_STATS_SUB_BUCKET_BITS)
+#define EXAMPLE_STATS_BUCKET_COUNT ((64 - EXAMPLE_STATS_SUB_BUCKET_BITS + 1) * EXAMPLE_STATS_SUB_BUCKETS)
+
+typedef struct ExampleTimeStats {
+    vector<unsigned long long> counts;
+    unsigned long long count;
+    double average;
+    unsigned long long min;
+    unsigned long long max;
+} ExampleTimeStats;
+
+static unsigned int exampleMostSignificantBit(unsigned long long value) {
+    unsigned int bit = 0;
+    if (value >> 32) { value >>= 32; bit += 32; }
+    if (value >> 16) { value >>= 16; bit += 16; }
+    if (value >> 8) { value >>= 8; bit += 8; }
+    if (value >> 4) { value >>= 4; bit += 4; }
+    if (value >> 2) { value >>= 2; bit += 2; }
+    if (value >> 1) { bit += 1; }
+
+    return bit;
+}
+
+static size_t exampleGetTimeStatsIndex(unsigned long long value) {
+    unsigned int msb = exampleMostSignificantBit(value);
+    unsigned int bucket = (msb > EXAMPLE_STATS_SUB_BUCKET_BITS) ? msb - EXAMPLE_STATS_SUB_BUCKET_BITS : 0;
+
+    return ((size_t)bucket << EXAMPLE_STATS_SUB_BUCKET_BITS) + (size_t)(value >> bucket);
+}
+
+// Returns the highest value that is counted in the histogram entry at the given index
+static unsigned long long exampleGetTimeStatsValue(size_t index) {
+    if (index < 2 * EXAMPLE_STATS_SUB_BUCKETS) {
+        return index;
+    }
+
+    unsigned int bucket = (unsigned int)(index >> EXAMPLE_STATS_SUB_BUCKET_BITS) - 1;
+    unsigned long long subBucket = index - ((size_t)bucket << EXAMPLE_STATS_SUB_BUCKET_BITS);
+
+    return ((subBucket + 1) << bucket) - 1;
+}
+
+static ExampleTimeStats exampleInitTimeStats() {
+    ExampleTimeStats stats;
+    stats.counts.assign(EXAMPLE_STATS_BUCKET_COUNT, 0);
+    stats.count = 0;
+    stats.average = 0;
+    stats.min = 0;
+    stats.max = 0;
+
+    return stats;
+}
+
+static ExampleTimeStats* exampleAddNanosecondsToTimeStats(ExampleTimeStats* stats, unsigned long long nanoseconds) {
+    stats->counts[exampleGetTimeStatsIndex(nanoseconds)]++;
+    stats->average = (stats->count * stats->average + nanoseconds) / (stats->count + 1);
+    stats->min = (stats->count == 0 || nanoseconds < stats->min) ? nanoseconds : stats->min;
+    stats->max = (nanoseconds > stats->max) ? nanoseconds : stats->max;
+    stats->count++;
+
+    return stats;
+}
+
+// Returns the value below which the given percentage (0..100) of the recorded values fall
+static unsigned long long exampleGetPercentileFromTimeStats(const ExampleTimeStats& stats, double percentile) {
+    if (stats.count == 0) {
+        return 0;
+    }
+
+    unsigned long long target = (unsigned long long)((percentile / 100.0) * stats.count + 0.5);
+    if (target < 1) {
+        target = 1;
+    }
+
+    unsigned long long total = 0;
+    for (size_t i = 0; i < EXAMPLE_STATS_BUCKET_COUNT; i++) {
+        total += stats.counts[i];
+        if (total >= target) {
+            unsigned long long value = exampleGetTimeStatsValue(i);
+            return (value > stats.max) ? stats.max : value;
+        }
+    }
+
+    return stats.max;
+}
+
+static void exampleResetTimeStats(ExampleTimeStats& stats) {
+    fill(stats.counts.begin(), stats.counts.end(), 0);
+    stats.count = 0;
+    stats.average = 0;
+    stats.min = 0;
+    stats.max = 0;
+}
+
+// Adds all values recorded in 'from' to 'stats'
+static void exampleMergeTimeStats(ExampleTimeStats& stats, const ExampleTimeStats& from) {
+    if (from.count == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < EXAMPLE_STATS_BUCKET_COUNT; i++) {
+        stats.counts[i] += from.counts[i];
+    }
+    stats.average = (stats.count * stats.average + from.count * from.average) / (stats.count + from.count);
+    stats.min = (stats.count == 0 || from.min < stats.min) ? from.min : stats.min;
+    stats.max = (from.max > stats.max) ? from.max : stats.max;
+    stats.count += from.count;
+}
+
+static ExampleTimeStats& operator+=(ExampleTimeStats& stats, unsigned long long nanoseconds) {
+    return *exampleAddNanosecondsToTimeStats(&stats, nanoseconds);
+}
+
+static ExampleTimeStats& operator+=(ExampleTimeStats& stats, const ExampleTimeStats& from) {
+    exampleMergeTimeStats(stats, from);
+    return stats;
+}
+
+// Data that is written by one thread and read by another is kept on its own cache lines, so the
+// reading thread does not slow down the writing thread by false sharing
+#define EXAMPLE_CACHE_LINE_SIZE 64
+
+// Single-writer seqlock: the writing thread publishes a struct of counters without blocking, and
+// a reading thread retries its copy until the struct was not published again while it copied.
+// The struct is copied as words through relaxed atomics.
+template<typename T>
+class alignas(EXAMPLE_CACHE_LINE_SIZE) ExampleSeqlock {
+private:
+    static const size_t WORD_COUNT = (sizeof(T) + sizeof(unsigned long long) - 1) / sizeof(unsigned long long);
+
+    atomic<unsigned long long> m_sequence;
+    atomic<unsigned long long> m_words[WORD_COUNT];
+
+public:
+    ExampleSeqlock() : m_sequence(0) {
+        for (size_t i = 0; i < WORD_COUNT; i++) {
+            m_words[i].store(0, memory_order_relaxed);
+        }
+    }
+
+    void publish(const T& value) {
+        unsigned long long words[WORD_COUNT] = {};
+        memcpy(words, &value, sizeof(T));
+
+        unsigned long long sequence = m_sequence.load(memory_order_relaxed);
+        m_sequence.store(sequence + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        for (size_t i = 0; i < WORD_COUNT; i++) {
+            m_words[i].store(words[i], memory_order_relaxed);
+        }
+        m_sequence.store(sequence + 2, memory_order_release);
+    }
+
+    T read() const {
+        unsigned long long words[WORD_COUNT];
+        unsigned long long before;
+        unsigned long long after;
+        do {
+            before = m_sequence.load(memory_order_acquire);
+            for (size_t i = 0; i < WORD_COUNT; i++) {
+                words[i] = m_words[i].load(memory_order_relaxed);
+            }
+            atomic_thread_fence(memory_order_acquire);
+            after = m_sequence.load(memory_order_relaxed);
+        } while ((before & 1) || before != after);
+
+        T value;
+        memcpy(&value, words, sizeof(T));
+        return value;
+    }
+};